@@ -1,43 +1,650 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#ifdef NEKO_WITH_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 // Define maximum sizes for various inputs and names
 #define INPUT_SIZE 256
-#define NAME_SIZE 64
-#define VALUE_SIZE 256
 #define FUNCTION_CODE_SIZE 4096
 
-// Structure to store a variable
+// Strings up to this many characters are stored inside the NekoString itself
+#define STRING_INLINE_CAPACITY 15
+
+// Structure to store a string value with a cached length; short strings need no allocation
+typedef struct NekoString {
+    uint32_t length;
+    uint32_t capacity;      // Size of the heap buffer, or 0 while the text is inline
+    union {
+        char inline_text[STRING_INLINE_CAPACITY + 1];
+        char *heap_text;
+    } data;
+} NekoString;
+
+// Structure to build a string piece by piece in linear time
+typedef struct StringBuilder {
+    char *data;
+    size_t length;
+    size_t capacity;
+} StringBuilder;
+
+// When the interpreter's stdout buffer is handed to write(2)
+typedef enum FlushPolicy {
+    FLUSH_LINE,             // After every complete line (default on a terminal)
+    FLUSH_SIZE,             // Once OUTPUT_FLUSH_THRESHOLD bytes are buffered (default otherwise)
+    FLUSH_END               // Only when the buffer is full or the run ends
+} FlushPolicy;
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define OUTPUT_FLUSH_THRESHOLD (64 * 1024)
+
+// Structure to store an interned name; each distinct name is allocated once
+typedef struct Symbol {
+    uint32_t hash;
+    uint32_t length;
+    char name[];
+} Symbol;
+
+// Structure to store a variable; compiled code addresses it by slot index
 typedef struct Variable {
-    char name[NAME_SIZE];
-    char value[VALUE_SIZE];
-    struct Variable *next;
+    const Symbol *symbol;
+    int defined;            // 0 until the variable is first assigned
+    NekoString value;
 } Variable;
 
-// Structure to store a function
+// Structure for one entry of the name -> slot hash table
+typedef struct VariableEntry {
+    const Symbol *symbol;   // NULL for an empty entry
+    uint32_t slot;
+} VariableEntry;
+
+// Hash tables start at this many slots and double when they pass 3/4 full
+#define TABLE_MIN_CAPACITY 64
+
+// Opcodes understood by the bytecode VM; operands follow each opcode in the code array
+typedef enum OpCode {
+    OP_HALT,                // End of the program
+    OP_PURR,                // piece count, then (piece kind, constant or slot) per piece
+    OP_KITTEN,              // variable slot, value constant
+    OP_MEOW,                // variable slot
+    OP_WINDOW,              // title constant, width, height
+    OP_DRAW_SCENE,          // no operands
+    OP_ADD_BLOCK,           // x, y, z as float bits, block type
+    OP_REMOVE_BLOCK,        // x, y, z as float bits
+    OP_DEFINE_FUNC,         // function slot, compiled body index
+    OP_CALL_FUNC,           // function slot
+    OP_IS_KEY_PRESSED,      // key constant
+    OP_SET_PLAYER_POSITION, // x, y, z as float bits
+    OP_RENDER_MODE,         // RenderMode value
+    OP_RENDER_STATS,        // no operands
+    OP_REGION,              // RegionOp, x1, y1, z1, x2, y2, z2 as float bits, from type, to type
+    OP_SAVE_WORLD,          // path constant
+    OP_LOAD_WORLD,          // path constant
+    OP_STREAM_WORLD,        // radius in chunks, memory cap in MiB
+    OP_STREAM_STATS,        // no operands
+    OP_WORLD_STORAGE,       // WorldStorage value
+    OP_ERROR,               // message constant printed to stderr
+    OP_TRACE                // message constant printed in verbose mode
+} OpCode;
+
+// Structure to describe a run of source text without copying it
+typedef struct Span {
+    size_t offset;
+    size_t length;
+} Span;
+
+// Kinds of tokens produced by the lexer
+typedef enum TokenKind {
+    TOKEN_END,              // End of the source
+    TOKEN_NEWLINE,
+    TOKEN_IDENTIFIER,
+    TOKEN_NUMBER,
+    TOKEN_STRING,           // Span covers the text between the quotes
+    TOKEN_SYMBOL,           // Any other single character
+    TOKEN_ERROR             // Unterminated string
+} TokenKind;
+
+// Structure to store a token as a span over the source buffer
+typedef struct Token {
+    TokenKind kind;
+    Span span;
+} Token;
+
+// Structure to store the lexer's position in a source buffer; the buffer is never modified
+typedef struct Lexer {
+    const char *source;
+    size_t length;
+    size_t pos;
+    int in_function;        // Lexing a function body, where statements end at ';'
+} Lexer;
+
+// Structure to store compiler state between batches when a script is compiled piecewise
+typedef struct Compiler {
+    Lexer lex;
+    int in_neko_block;      // Flag to check if inside a 'neko { }' block
+} Compiler;
+
+// Structure to store a loaded script; regular files are mapped rather than copied
+typedef struct ScriptSource {
+    const char *code;
+    size_t length;
+    int mapped;             // 1 if code is an mmap of the file, 0 if it was read into memory
+} ScriptSource;
+
+// Amount of source compiled per batch in streaming mode
+#define STREAM_BATCH_BYTES (256 * 1024)
+
+// Commands that can start a statement
+typedef enum Command {
+    CMD_UNKNOWN,
+    CMD_PURR,
+    CMD_KITTEN,
+    CMD_MEOW,
+    CMD_WINDOW,
+    CMD_DRAW_SCENE,
+    CMD_ADD_BLOCK,
+    CMD_REMOVE_BLOCK,
+    CMD_FUNC,
+    CMD_CALL_FUNC,
+    CMD_IS_KEY_PRESSED,
+    CMD_SET_PLAYER_POSITION,
+    CMD_RENDER_MODE,
+    CMD_RENDER_STATS,
+    CMD_FILL,
+    CMD_HOLLOW_BOX,
+    CMD_REPLACE,
+    CMD_CLEAR,
+    CMD_SAVE_WORLD,
+    CMD_LOAD_WORLD,
+    CMD_STREAM_WORLD,
+    CMD_STREAM_STATS,
+    CMD_WORLD_STORAGE
+} Command;
+
+// Structure to map a command word to its command
+typedef struct Keyword {
+    const char *name;
+    Command command;
+} Keyword;
+
+// Size of the perfect-hash command table (power of two, comfortably above the keyword count)
+#define KEYWORD_TABLE_SIZE 64
+
+// Kinds of pieces in a 'purr' concatenation
+enum {
+    PIECE_LITERAL,
+    PIECE_VARIABLE
+};
+
+// Structure to store a compiled script
+typedef struct Bytecode {
+    uint32_t *code;         // Opcodes followed by their pre-decoded operands
+    size_t code_count;
+    size_t code_capacity;
+    NekoString *strings;    // Constant pool for names, literals and messages
+    size_t string_count;
+    size_t string_capacity;
+} Bytecode;
+
+// Structure to store a function; the slot is resolved at compile time
 typedef struct Function {
-    char name[NAME_SIZE];
-    char *code;
-    struct Function *next;
+    const Symbol *symbol;
+    Bytecode *body;         // NULL until the 'neko_func' statement has run
 } Function;
 
-// Linked lists for variables and functions
-Variable *variables_head = NULL;
-Function *functions_head = NULL;
+// Maximum nesting of 'call_func' before a call is refused
+#define MAX_CALL_DEPTH 256
+
+// Interned names (open addressing, linear probing)
+Symbol **symbols = NULL;
+size_t symbol_count = 0;
+size_t symbol_capacity = 0;
+
+// Variable values in one contiguous array, indexed by the slots compiled into bytecode
+Variable *variable_slots = NULL;
+size_t variable_count = 0;
+size_t variable_slot_capacity = 0;
+
+// Name -> slot index used while compiling (open addressing, linear probing)
+VariableEntry *variable_index = NULL;
+size_t variable_index_capacity = 0;
+
+// Function table indexed by slot, plus the compiled bodies it can point to
+Function *functions = NULL;
+size_t function_count = 0;
+size_t function_capacity = 0;
+Bytecode **function_bodies = NULL;
+size_t function_body_count = 0;
+size_t function_body_capacity = 0;
+int call_depth = 0;
+
+// Command words; the perfect-hash table below is generated from this list at startup
+const Keyword keywords[] = {
+    {"purr", CMD_PURR},
+    {"kitten", CMD_KITTEN},
+    {"meow", CMD_MEOW},
+    {"neko_window", CMD_WINDOW},
+    {"neko_draw_scene", CMD_DRAW_SCENE},
+    {"neko_add_block", CMD_ADD_BLOCK},
+    {"neko_remove_block", CMD_REMOVE_BLOCK},
+    {"neko_func", CMD_FUNC},
+    {"call_func", CMD_CALL_FUNC},
+    {"is_key_pressed", CMD_IS_KEY_PRESSED},
+    {"neko_set_player_position", CMD_SET_PLAYER_POSITION},
+    {"neko_render_mode", CMD_RENDER_MODE},
+    {"neko_render_stats", CMD_RENDER_STATS},
+    {"neko_fill", CMD_FILL},
+    {"neko_hollow_box", CMD_HOLLOW_BOX},
+    {"neko_replace", CMD_REPLACE},
+    {"neko_clear", CMD_CLEAR},
+    {"neko_save_world", CMD_SAVE_WORLD},
+    {"neko_load_world", CMD_LOAD_WORLD},
+    {"neko_stream_world", CMD_STREAM_WORLD},
+    {"neko_stream_stats", CMD_STREAM_STATS},
+    {"neko_world_storage", CMD_WORLD_STORAGE}
+};
+uint8_t keyword_table[KEYWORD_TABLE_SIZE]; // keywords[] index + 1, or 0 for an empty slot
+uint32_t keyword_seed = 0;
+int keyword_table_ready = 0;
+
+// Interpreter-owned stdout buffer; all normal output goes through output_write()
+char output_buffer[OUTPUT_BUFFER_SIZE];
+size_t output_length = 0;
+FlushPolicy flush_policy = FLUSH_LINE;
+
+// Scratch builder reused by 'purr' so concatenation does not allocate per statement
+StringBuilder purr_builder = {0};
+
+// Structure for an open-addressing map from packed coordinates to an index
+typedef struct CoordMap {
+    uint64_t *keys;         // COORD_EMPTY marks a free slot
+    uint32_t *values;
+    size_t count;
+    size_t capacity;
+} CoordMap;
+
+// Coordinates are packed into 21 bits per axis, so each axis spans [-COORD_LIMIT, COORD_LIMIT)
+#define COORD_BITS 21
+#define COORD_LIMIT (1 << (COORD_BITS - 1))
+#define COORD_EMPTY UINT64_MAX
+#define COORD_NOT_FOUND UINT32_MAX
+
+// The world is split into cubic chunks of CHUNK_SIZE^3 blocks
+#define CHUNK_SHIFT 4
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define CHUNK_VOLUME (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+
+// Region edits, applied to the chunks a box overlaps
+typedef enum RegionOp {
+    REGION_FILL,            // Every cell becomes the new type
+    REGION_HOLLOW,          // Only the cells on the faces of the box become the new type
+    REGION_REPLACE,         // Cells of one type become another
+    REGION_CLEAR            // Every cell becomes air
+} RegionOp;
+const char *region_names[] = { "neko_fill", "neko_hollow_box", "neko_replace", "neko_clear" };
+
+// Largest box a region edit that places blocks in air accepts, in blocks (4096 chunks' worth)
+#define REGION_MAX_BLOCKS (4096ull * 4096)
+
+// Block ids stored in chunks; scripts can use types 1 to BLOCK_TYPE_MAX
+#define BLOCK_AIR 0
+#define BLOCK_DEFAULT 1
+#define BLOCK_TYPE_MAX 15
+#define BLOCK_TYPE_COUNT (BLOCK_TYPE_MAX + 1)
+
+// Colour of each block type (entry 0, air, is never drawn)
+const float block_palette[BLOCK_TYPE_COUNT][3] = {
+    {0.00f, 0.00f, 0.00f}, // Air
+    {0.40f, 0.80f, 0.40f}, // 1: Grass green (the original block colour)
+    {0.50f, 0.50f, 0.52f}, // 2: Stone
+    {0.55f, 0.36f, 0.20f}, // 3: Dirt
+    {0.86f, 0.80f, 0.55f}, // 4: Sand
+    {0.25f, 0.45f, 0.85f}, // 5: Water
+    {0.45f, 0.30f, 0.15f}, // 6: Wood
+    {0.20f, 0.55f, 0.20f}, // 7: Leaves
+    {0.70f, 0.25f, 0.20f}, // 8: Brick
+    {0.95f, 0.95f, 0.97f}, // 9: Snow
+    {0.90f, 0.75f, 0.20f}, // 10: Gold
+    {0.15f, 0.15f, 0.17f}, // 11: Coal
+    {0.75f, 0.85f, 0.90f}, // 12: Glass
+    {0.95f, 0.55f, 0.70f}, // 13: Pink (for cats)
+    {0.60f, 0.35f, 0.75f}, // 14: Purple
+    {0.95f, 0.50f, 0.15f}  // 15: Orange
+};
+
+// A chunk's blocks plus a one-block border taken from its neighbours, as read by the mesher
+#define PADDED_SIZE (CHUNK_SIZE + 2)
+#define PADDED_VOLUME (PADDED_SIZE * PADDED_SIZE * PADDED_SIZE)
+
+// Saved worlds: a header, a table with one entry per chunk, then each chunk's packed blocks.
+// Packed blocks are a uint16 palette size, the palette (block ids), then runs of uint16 length and
+// uint16 palette index in chunk_block_index() order. Fields use the byte order of the writer.
+#define WORLD_MAGIC "NEKOWRLD"
+#define WORLD_VERSION 1
+
+typedef struct WorldHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_size;    // CHUNK_SIZE of the writer
+    uint64_t chunk_count;   // Table entries following the header
+} WorldHeader;
+
+typedef struct WorldChunkEntry {
+    int32_t cx, cy, cz;
+    uint32_t block_count;
+    uint64_t offset;        // Packed blocks, from the start of the file
+    uint32_t length;        // Bytes of packed blocks
+    uint32_t reserved;
+} WorldChunkEntry;
+
+// Largest packed chunk: the palette size, a full palette and one run per block
+#define WORLD_PACKED_MAX (2 + 2 * CHUNK_VOLUME + 4 * CHUNK_VOLUME)
+
+// Structure for a mapped world file, kept until nothing reads blocks from it any more
+typedef struct WorldMap {
+    uint8_t *data;
+    size_t length;
+    size_t references;      // Packed chunks, stored chunks and reads in flight that use the map
+} WorldMap;
+
+// How resident chunks keep their blocks, selected per world with 'neko_world_storage' or --storage=
+typedef enum WorldStorage {
+    STORAGE_FLAT,           // A CHUNK_VOLUME array of block ids
+    STORAGE_OCTREE,         // A sparse voxel octree that collapses uniform cubes
+    STORAGE_PALETTE         // Bit-packed indices into a per-chunk palette, unpacked while the chunk is hot
+} WorldStorage;
+const char *storage_names[] = { "flat", "octree", "palette" };
+WorldStorage world_storage = STORAGE_FLAT;
+
+// Structure for a chunk stored as a sparse voxel octree. A node is either a leaf holding the block id
+// of its whole cube, or the index of its 8 children, which sit together in a group. Node 0 is the root.
+typedef struct Octree {
+    uint32_t *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t free_group;    // First freed group, chained through each group's first node
+    uint32_t free_nodes;    // Nodes in freed groups; the tree is compacted once they are over half of count
+} Octree;
+#define OCTREE_LEAF 0x80000000u
+#define OCTREE_NONE UINT32_MAX
+
+// Structure for a chunk stored as bit-packed palette indices. The index width is the smallest of
+// 0, 1, 2, 4, 8 or 16 bits that fits the palette, so indices never straddle two words. Packed
+// chunks are never written in place: edits go to the flat copy in the palette cache.
+typedef struct PaletteBlocks {
+    uint16_t *ids;          // Block id of each palette index
+    uint64_t *words;        // CHUNK_VOLUME indices in chunk_block_index() order; NULL when bits is 0
+    uint16_t count;         // Palette entries
+    uint8_t bits;
+} PaletteBlocks;
+
+// Structure to store one chunk of blocks and the mesh drawn for it
+typedef struct Chunk {
+    int32_t cx, cy, cz;     // Chunk coordinates (block coordinates >> CHUNK_SHIFT)
+    uint16_t *blocks;       // Flat storage: CHUNK_VOLUME block ids indexed by chunk_block_index()
+    Octree octree;          // Octree storage (nodes is NULL otherwise)
+    PaletteBlocks palette;  // Palette storage while cold (ids is NULL otherwise); none is set while packed
+    int cached;             // Palette storage, hot: blocks holds the flat copy and the chunk is in the palette cache
+    struct Chunk *lru_prev, *lru_next; // Palette cache order, most recently written first
+    WorldMap *packed_map;   // Set for a loaded chunk until its blocks are first used
+    const uint8_t *packed;
+    uint32_t packed_length;
+    WorldMap *stored_map;   // Copy of the blocks in a world file (or the spill file when NULL) that an
+    uint64_t stored_offset; // unchanged chunk is evicted to instead of being written again;
+    uint32_t stored_length; // 0 once the blocks change or for a chunk that was never stored
+    uint32_t block_count;   // Number of blocks that are not air
+    GLuint vao, vbo;        // Mesh, created on first draw
+    uint32_t vertex_count;
+    int dirty;              // Blocks changed since the mesh was built; the chunk is then in the remesh queue
+    uint32_t mesh_generation; // Generation of the snapshot the uploaded mesh was built from
+} Chunk;
+
+// Structure to collect mesh vertices before they are uploaded
+typedef struct MeshBuffer {
+    float *data;
+    size_t count;           // Floats used
+    size_t capacity;
+} MeshBuffer;
+
+// Chunks in a dense array plus an index from packed chunk coordinates to array slot
+Chunk **chunks = NULL;
+size_t chunk_count = 0;
+size_t chunk_capacity = 0;
+CoordMap chunk_index = {0};
+MeshBuffer mesh_scratch = {0};
+
+// Palette chunks that were written recently keep a flat copy; the least recently written one is
+// packed again when the cache is full
+size_t palette_cache_size = 64;
+size_t palette_cache_count = 0;
+Chunk *palette_lru_head = NULL, *palette_lru_tail = NULL;
+
+// FIFO of packed coordinates of chunks waiting for a new mesh. Keys of chunks that
+// were freed in the meantime are skipped when they come up.
+uint64_t *remesh_queue = NULL;
+size_t remesh_head = 0;
+size_t remesh_count = 0;
+size_t remesh_capacity = 0;
+
+// Meshes rebuilt per frame at most (0 = no limit), so bursts of edits are spread over frames
+size_t remesh_budget = 16;
+size_t chunks_remeshed = 0; // In the last frame
+
+// Structure for one meshing job: a chunk snapshot in, its mesh out
+typedef struct MeshJob {
+    uint64_t key;           // Packed coordinates of the chunk
+    uint32_t generation;    // Orders snapshots of the same chunk; newer results replace older ones
+    int32_t origin[3];      // World position of the chunk's first block
+    uint16_t padded[PADDED_VOLUME];
+    MeshBuffer mesh;
+    struct MeshJob *next;   // Link in the finished, ready and free lists
+} MeshJob;
+
+// Structure for a worker's deque: the worker pops its newest job, idle workers steal the oldest
+typedef struct JobDeque {
+    pthread_mutex_t lock;
+    MeshJob **jobs;         // Ring buffer
+    size_t top;             // Oldest job
+    size_t count;
+    size_t capacity;
+} JobDeque;
+
+// Meshing jobs in flight at most; bounds the memory held by snapshots
+#define MESH_JOBS_IN_FLIGHT 256
+
+// Worker pool that meshes chunk snapshots off the GL thread (-1 = one per spare core, 0 = no workers)
+int mesh_thread_count = -1;
+int mesh_workers_started = 0;
+pthread_t *mesh_workers = NULL;
+JobDeque *mesh_deques = NULL;
+size_t mesh_next_deque = 0;     // Round-robin target for new jobs
+
+// Shared by the workers: jobs pushed but not yet claimed, and the shutdown request
+pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+size_t jobs_unclaimed = 0;
+int jobs_shutdown = 0;
+
+// Finished jobs handed back to the GL thread
+pthread_mutex_t jobs_done_lock = PTHREAD_MUTEX_INITIALIZER;
+MeshJob *jobs_done = NULL;
+
+// Owned by the GL thread: finished jobs waiting for upload, recycled jobs, and the job count
+MeshJob *jobs_ready = NULL;
+MeshJob *jobs_free = NULL;
+size_t jobs_in_flight = 0;      // Submitted and not yet uploaded or dropped
+uint32_t mesh_generation_counter = 0;
+
+// World streaming: chunks farther than world_stream_radius chunks from the player are written to a
+// spill file and read back on an I/O thread as the player approaches (0 = everything stays resident)
+int world_stream_radius = 0;
+size_t world_memory_cap = 0;    // Bytes of resident block and mesh memory at most (0 = no cap)
+
+// Structure for a chunk that is not resident: where its packed blocks are kept
+typedef struct StoredChunk {
+    int32_t cx, cy, cz;
+    uint32_t block_count;
+    WorldMap *map;          // Loaded world the blocks are still in, or NULL for the spill file
+    uint64_t offset;        // Packed blocks, from the start of the map or spill file
+    uint32_t length;
+    int loading;            // A read is queued on the I/O thread
+} StoredChunk;
+
+// Non-resident chunks in a dense array plus an index from packed chunk coordinates to array slot
+StoredChunk *stored_chunks = NULL;
+size_t stored_count = 0;
+size_t stored_capacity = 0;
+CoordMap stored_index = {0};
+
+// Unlinked temporary file evicted chunks are written to. Space is handed out in power-of-two
+// sizes from SPILL_CLASS_MIN up, and freed space is reused by the next chunk of the same size.
+#define SPILL_CLASS_MIN 6
+#define SPILL_CLASSES 10
+int spill_fd = -1;
+uint64_t spill_end = 0;
+
+// Structure for the freed spill space of one size
+typedef struct SpillFreeList {
+    uint64_t *offsets;
+    size_t count;
+    size_t capacity;
+} SpillFreeList;
+SpillFreeList spill_free_lists[SPILL_CLASSES];
+
+// Structure for one read handed to the I/O thread: packed blocks in, decoded blocks out
+typedef struct StreamRequest {
+    uint64_t key;
+    WorldMap *map;          // Holds a reference while the read is in flight
+    uint64_t offset;
+    uint32_t length;
+    uint32_t block_count;
+    double requested;       // now_seconds() when queued, for the load latency stats
+    uint16_t *blocks;       // NULL if the data was unreadable or corrupted
+    struct StreamRequest *next;
+} StreamRequest;
 
-// Structures for voxel management and player
-typedef struct Voxel {
-    float x, y, z;
-    struct Voxel *next;
-} Voxel;
+// Reads in flight at most; bounds the decoded chunks waiting to be picked up
+#define STREAM_LOADS_IN_FLIGHT 64
+// Chunks evicted for being out of range per frame at most (evictions to honour the cap are not limited)
+#define STREAM_EVICTIONS_PER_FRAME 64
 
-Voxel *voxels_head = NULL;
+// I/O thread and its queues; the GL thread owns everything else
+pthread_t stream_thread;
+int stream_thread_started = 0;
+pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t stream_ready = PTHREAD_COND_INITIALIZER;
+StreamRequest *stream_queue_head = NULL, *stream_queue_tail = NULL;
+StreamRequest *stream_done = NULL;
+int stream_shutdown = 0;
+size_t stream_in_flight = 0;
+
+// Stored chunks within range of the player, nearest first, rebuilt when the player enters another chunk
+uint64_t *stream_wanted = NULL;
+size_t stream_wanted_count = 0;
+size_t stream_wanted_capacity = 0;
+size_t stream_wanted_next = 0;
+int32_t stream_center[3];
+int stream_center_valid = 0;
+
+// Streaming counters since startup, and the resident memory: measured each frame, then raised as
+// chunks become resident in between
+size_t stream_loads = 0;
+size_t stream_sync_loads = 0;
+size_t stream_evictions = 0;
+size_t resident_bytes = 0;
 
 // OpenGL-related global variables
 unsigned int VAO = 0, VBO = 0;
+
+// Ways of drawing the blocks, selected with 'neko_render_mode' or --render=
+typedef enum RenderMode {
+    RENDER_CHUNKED,         // One greedy mesh per chunk
+    RENDER_INSTANCED,       // One instanced draw of the cube for every block
+    RENDER_PER_VOXEL        // One draw call per block
+} RenderMode;
+const char *render_mode_names[] = { "chunked", "instanced", "per_voxel" };
+RenderMode render_mode = RENDER_CHUNKED;
+
+// Cube VAO with a per-instance block offset, and the offsets it reads
+unsigned int instance_VAO = 0, instance_VBO = 0;
+uint32_t instance_count = 0;
+int instances_dirty = 1;    // Blocks changed since the offsets were uploaded
+
+// Uniform locations resolved once when the shader program is built
+GLint uniform_model = -1;
+GLint uniform_palette = -1;
+GLint uniform_light_color = -1;
+
+// Uniform buffer holding the camera's view and projection matrices, bound to CAMERA_BINDING
+#define CAMERA_BINDING 0
+unsigned int camera_UBO = 0;
+int camera_dirty = 1;       // Player moved since the camera block was uploaded
+float frustum[6][4];        // Planes matching the uploaded camera
+
+// Chunks submitted and skipped by frustum culling in the last frame
+size_t chunks_drawn = 0;
+size_t chunks_culled = 0;
+
+// Vertices for a unit cube centred on the origin (12 triangles)
+const float cube_vertices[] = {
+    // positions
+    -0.5f, -0.5f, -0.5f,
+     0.5f, -0.5f, -0.5f,
+     0.5f,  0.5f, -0.5f,
+     0.5f,  0.5f, -0.5f,
+    -0.5f,  0.5f, -0.5f,
+    -0.5f, -0.5f, -0.5f,
+
+    -0.5f, -0.5f,  0.5f,
+     0.5f, -0.5f,  0.5f,
+     0.5f,  0.5f,  0.5f,
+     0.5f,  0.5f,  0.5f,
+    -0.5f,  0.5f,  0.5f,
+    -0.5f, -0.5f,  0.5f,
+
+    -0.5f,  0.5f,  0.5f,
+    -0.5f,  0.5f, -0.5f,
+    -0.5f, -0.5f, -0.5f,
+    -0.5f, -0.5f, -0.5f,
+    -0.5f, -0.5f,  0.5f,
+    -0.5f,  0.5f,  0.5f,
+
+     0.5f,  0.5f,  0.5f,
+     0.5f,  0.5f, -0.5f,
+     0.5f, -0.5f, -0.5f,
+     0.5f, -0.5f, -0.5f,
+     0.5f, -0.5f,  0.5f,
+     0.5f,  0.5f,  0.5f,
+
+    -0.5f, -0.5f, -0.5f,
+     0.5f, -0.5f, -0.5f,
+     0.5f, -0.5f,  0.5f,
+     0.5f, -0.5f,  0.5f,
+    -0.5f, -0.5f,  0.5f,
+    -0.5f, -0.5f, -0.5f,
+
+    -0.5f,  0.5f, -0.5f,
+     0.5f,  0.5f, -0.5f,
+     0.5f,  0.5f,  0.5f,
+     0.5f,  0.5f,  0.5f,
+    -0.5f,  0.5f,  0.5f,
+    -0.5f,  0.5f, -0.5f
+};
 GLFWwindow* gl_window = NULL;
 GLuint shaderProgram = 0;
 
@@ -51,130 +658,465 @@ int opengl_initialized = 0;
 // Verbose mode flag
 int verbose = 0;
 
+// Streaming mode flag: compile and run the script in batches instead of all at once
+int stream_mode = 0;
+
+// Largest window or framebuffer side 'neko_window' accepts
+#define WINDOW_SIZE_MAX 16384
+
+// Headless mode: 'neko_window' renders offscreen, and a fixed number of frames replaces the window loop
+int headless_mode = 0;
+int headless_frames = 100;
+const char *dump_frame_path = NULL;    // PPM file for the last frame, or NULL
+int headless_width = 0, headless_height = 0;
+GLuint headless_FBO = 0, headless_color_RBO = 0, headless_depth_RBO = 0;
+#ifdef NEKO_WITH_EGL
+EGLDisplay egl_display = EGL_NO_DISPLAY;
+EGLContext egl_context = EGL_NO_CONTEXT;
+#endif
+
+// Parts of a frame that are timed separately
+typedef enum TimerPhase {
+    PHASE_SCRIPT,           // Script or input handling since the previous frame
+    PHASE_REMESH,           // Streaming chunks in and out, building or uploading chunk meshes
+    PHASE_DRAW,             // Issuing the draw calls (CPU side)
+    PHASE_PRESENT,          // glfwSwapBuffers and event polling, or glFinish when headless
+    PHASE_GPU,              // GPU time from a timer query
+    PHASE_FRAME,            // Whole frame, previous frame end to this frame end
+    PHASE_STREAM_LOAD,      // Not a frame phase: streamed chunk reads, from request to pickup
+    PHASE_COUNT
+} TimerPhase;
+const char *phase_names[PHASE_COUNT] = { "script", "remesh", "draw", "present", "gpu", "frame", "stream_load" };
+
+// Rolling window of recent samples per phase, in seconds
+#define STATS_WINDOW 1024
+typedef struct PhaseStats {
+    double samples[STATS_WINDOW];
+    size_t next;            // Slot the next sample goes into
+    size_t count;           // Samples in the window
+    size_t total_count;     // Samples ever recorded
+    double total;           // Sum of all samples ever recorded
+} PhaseStats;
+PhaseStats phase_stats[PHASE_COUNT];
+double frame_started = 0.0;      // When the current frame began (end of the previous one)
+double frame_remesh_time = 0.0;  // Streaming and remesh time inside the current neko_draw_scene()
+double stats_last_report = 0.0;
+size_t stats_frames_at_report = 0;
+const char *stats_path = NULL;   // --stats=file.csv or file.json, written when rendering ends
+int stats_overlay = 0;           // --overlay: show frame times in the window title
+char window_title[256] = "";
+
+// GPU timer queries, double-buffered so reading last frame's result never stalls
+GLuint gpu_queries[2] = {0, 0};
+int gpu_query_pending[2] = {0, 0};
+size_t gpu_query_frame = 0;
+
 // Function declarations
+void output_flush(void);
+void output_write(const char *text, size_t length);
+void output_printf(const char *format, ...);
 char* get_user_input(const char *prompt);
-void set_variable(const char *name, const char *value);
-char* get_variable(const char *name);
-void store_function(const char *name, const char *code);
-char* get_function_code(const char *name);
-char* trim(char *str);
-void interpret(const char *code, int gui_mode);
+uint32_t hash_name(const char *name, size_t length);
+const Symbol* intern_symbol(const char *name, size_t length);
+uint32_t resolve_variable(const char *name, size_t length);
+char* string_data(NekoString *str);
+void string_assign(NekoString *str, const char *text, size_t length);
+void string_free(NekoString *str);
+void builder_append(StringBuilder *sb, const char *text, size_t length);
+void builder_free(StringBuilder *sb);
+void assign_variable(uint32_t slot, const char *value, size_t length);
+uint32_t resolve_function(const char *name, size_t length);
+uint32_t add_function_body(Bytecode *body);
+void interpret(const char *code, size_t length);
 void neko_window(const char *title, int width, int height);
 void neko_draw_scene(); // Only one declaration
-void neko_add_block(float x, float y, float z);
+uint64_t pack_coords(int32_t x, int32_t y, int32_t z);
+uint32_t coord_map_find(const CoordMap *map, uint64_t key);
+void coord_map_insert(CoordMap *map, uint64_t key, uint32_t value);
+void coord_map_remove(CoordMap *map, uint64_t key);
+void coord_map_free(CoordMap *map);
+Chunk* find_chunk(int32_t cx, int32_t cy, int32_t cz);
+uint16_t chunk_get(Chunk *chunk, int index);
+void chunk_unpack(Chunk *chunk);
+void release_world_map(WorldMap *map);
+Chunk* stream_in_now(uint32_t slot);
+Chunk* resident_chunk(int32_t cx, int32_t cy, int32_t cz);
+void stream_in_range(const int32_t lo[3], const int32_t hi[3]);
+void spill_free(uint64_t offset, uint32_t length);
+void chunk_drop_stored(Chunk *chunk);
+void stream_hold_cap(const Chunk *keep);
+int chunk_in_stream_range(int32_t cx, int32_t cy, int32_t cz);
+void add_stored_chunk(int32_t cx, int32_t cy, int32_t cz, uint32_t block_count, WorldMap *map,
+                      uint64_t offset, uint32_t length);
+int stream_read_packed(WorldMap *map, uint64_t offset, uint32_t length, uint16_t *out);
+void stream_update(void);
+void clear_stored_chunks(void);
+void clear_world(void);
+uint16_t world_get_block(int32_t x, int32_t y, int32_t z);
+uint16_t world_set_block(int32_t x, int32_t y, int32_t z, uint16_t id);
+void chunk_build_mesh(Chunk *chunk);
+void chunk_mark_dirty(Chunk *chunk);
+void stop_mesh_workers(void);
+void submit_mesh_job(Chunk *chunk);
+void upload_finished_meshes(void);
+void remesh_dirty_chunks(void);
+void mesh_append(MeshBuffer *mesh, const float *values, size_t count);
+void upload_instances(void);
+void matrix_multiply(const float *a, const float *b, float *out);
+void frustum_planes(const float *m, float planes[6][4]);
+int chunk_in_frustum(const Chunk *chunk, const float planes[6][4]);
+void update_camera(void);
+void neko_headless_window(int width, int height);
+void headless_shutdown(void);
+void run_headless_frames(void);
+double now_seconds(void);
+void stats_record(TimerPhase phase, double seconds);
+void stats_percentiles(TimerPhase phase, double out[4]);
+void render_frame(void);
+void neko_add_block(float x, float y, float z, uint16_t type);
+size_t world_edit_region(const int32_t lo[3], const int32_t hi[3], RegionOp op, uint16_t from, uint16_t to);
+void neko_region(RegionOp op, const float corners[6], uint16_t from, uint16_t to);
 void neko_remove_block(float x, float y, float z);
-char* read_code_from_file(const char *filename);
+void neko_save_world(const char *path);
+void neko_load_world(const char *path);
+void neko_stream_world(int radius, size_t cap_bytes);
+void neko_stream_stats(void);
+int load_script_file(const char *filename, ScriptSource *script);
+void free_script_file(ScriptSource *script);
 void setup_opengl_objects();
 GLuint compile_shader(const char* source, GLenum type);
 GLuint create_shader_program(const char* vertexSource, const char* fragmentSource);
 void cleanup();
-int detect_gui_mode(const char *code);
 int is_key_pressed(const char *key);
 void neko_set_player_position(float x, float y, float z);
+int parse_render_mode(const char *name, size_t length);
+int parse_world_storage(const char *name, size_t length);
+void neko_world_storage(WorldStorage storage);
+size_t chunk_memory(const Chunk *chunk);
+int compile_batch(Compiler *compiler, Bytecode *bc, size_t stop_at);
+void compile(const char *code, size_t length, Bytecode *bc);
+int run_bytecode(const Bytecode *bc, int *gui_mode);
+void free_bytecode(Bytecode *bc);
 
 // Function implementations
 
+// Function to write the buffered output to stdout with as few write(2) calls as possible
+void output_flush(void) {
+    size_t written = 0;
+    while (written < output_length) {
+        ssize_t n = write(STDOUT_FILENO, output_buffer + written, output_length - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break; // Nothing sensible to do if stdout is gone; drop the output
+        }
+        written += (size_t)n;
+    }
+    output_length = 0;
+}
+
+// Function to apply the flush policy after new output has been buffered
+void output_maybe_flush(const char *text, size_t length) {
+    switch (flush_policy) {
+        case FLUSH_LINE:
+            if (memchr(text, '\n', length) != NULL) output_flush();
+            break;
+        case FLUSH_SIZE:
+            if (output_length >= OUTPUT_FLUSH_THRESHOLD) output_flush();
+            break;
+        case FLUSH_END:
+            break;
+    }
+}
+
+// Function to append text to the stdout buffer
+void output_write(const char *text, size_t length) {
+    if (length > OUTPUT_BUFFER_SIZE - output_length) {
+        output_flush();
+        if (length >= OUTPUT_BUFFER_SIZE) {
+            // Too big to buffer; hand it straight to the kernel
+            size_t written = 0;
+            while (written < length) {
+                ssize_t n = write(STDOUT_FILENO, text + written, length - written);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return;
+                }
+                written += (size_t)n;
+            }
+            return;
+        }
+    }
+    memcpy(output_buffer + output_length, text, length);
+    output_length += length;
+    output_maybe_flush(text, length);
+}
+
+// Function to format text into the stdout buffer
+void output_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t space = OUTPUT_BUFFER_SIZE - output_length;
+    int n = vsnprintf(output_buffer + output_length, space, format, args);
+    va_end(args);
+    if (n < 0) return;
+
+    if ((size_t)n < space) {
+        // Formatted in place
+        output_length += (size_t)n;
+        output_maybe_flush(output_buffer + output_length - n, (size_t)n);
+        return;
+    }
+
+    // Did not fit in the remaining space; format into a temporary buffer instead
+    char *text = (char *)malloc((size_t)n + 1);
+    if (text == NULL) {
+        fprintf(stderr, "Memory allocation failed for output.\n");
+        exit(EXIT_FAILURE);
+    }
+    va_start(args, format);
+    vsnprintf(text, (size_t)n + 1, format, args);
+    va_end(args);
+    output_write(text, (size_t)n);
+    free(text);
+}
+
 // Function to obtain user input securely
 char* get_user_input(const char *prompt) {
     static char input[INPUT_SIZE];
-    printf("%s", prompt);
+    output_write(prompt, strlen(prompt));
+    output_flush(); // The prompt must be visible before we block on input
     if (fgets(input, sizeof(input), stdin) != NULL) {
         input[strcspn(input, "\n")] = '\0'; // Remove newline
     }
     return input;
 }
 
-// Function to set or update a variable
-void set_variable(const char *name, const char *value) {
-    Variable *current = variables_head;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            strncpy(current->value, value, VALUE_SIZE - 1);
-            current->value[VALUE_SIZE - 1] = '\0';
-            return;
+// Function to get the NUL-terminated characters of a string
+char* string_data(NekoString *str) {
+    return str->capacity ? str->data.heap_text : str->data.inline_text;
+}
+
+// Function to replace the contents of a string, reusing its heap buffer when it is big enough
+void string_assign(NekoString *str, const char *text, size_t length) {
+    char *dest;
+    if (str->capacity > length) {
+        dest = str->data.heap_text;
+    } else if (str->capacity == 0 && length <= STRING_INLINE_CAPACITY) {
+        dest = str->data.inline_text;
+    } else {
+        size_t new_capacity = length + 1;
+        if (new_capacity < (size_t)str->capacity * 2) new_capacity = (size_t)str->capacity * 2;
+        if (new_capacity > UINT32_MAX) {
+            fprintf(stderr, "String value too long.\n");
+            exit(EXIT_FAILURE);
+        }
+        dest = (char *)malloc(new_capacity);
+        if (dest == NULL) {
+            fprintf(stderr, "Memory allocation failed for string.\n");
+            exit(EXIT_FAILURE);
         }
-        current = current->next;
+        if (str->capacity) free(str->data.heap_text);
+        str->data.heap_text = dest;
+        str->capacity = (uint32_t)new_capacity;
     }
-    // Create a new variable if it doesn't exist
-    Variable *new_var = (Variable *)malloc(sizeof(Variable));
-    if (new_var == NULL) {
-        fprintf(stderr, "Memory allocation failed for variable.\n");
-        exit(EXIT_FAILURE);
+    memcpy(dest, text, length);
+    dest[length] = '\0';
+    str->length = (uint32_t)length;
+}
+
+// Function to release a string's heap buffer, leaving it empty
+void string_free(NekoString *str) {
+    if (str->capacity) free(str->data.heap_text);
+    memset(str, 0, sizeof(*str));
+}
+
+// Function to append text to a builder, growing it geometrically
+void builder_append(StringBuilder *sb, const char *text, size_t length) {
+    if (sb->length + length + 1 > sb->capacity) {
+        size_t new_capacity = sb->capacity ? sb->capacity * 2 : 256;
+        while (new_capacity < sb->length + length + 1) new_capacity *= 2;
+        char *new_data = (char *)realloc(sb->data, new_capacity);
+        if (new_data == NULL) {
+            fprintf(stderr, "Memory allocation failed for string builder.\n");
+            exit(EXIT_FAILURE);
+        }
+        sb->data = new_data;
+        sb->capacity = new_capacity;
+    }
+    memcpy(sb->data + sb->length, text, length);
+    sb->length += length;
+    sb->data[sb->length] = '\0';
+}
+
+// Function to release a builder's buffer
+void builder_free(StringBuilder *sb) {
+    free(sb->data);
+    memset(sb, 0, sizeof(*sb));
+}
+
+// Function to hash a name (FNV-1a)
+uint32_t hash_name(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
     }
-    strncpy(new_var->name, name, NAME_SIZE - 1);
-    new_var->name[NAME_SIZE - 1] = '\0';
-    strncpy(new_var->value, value, VALUE_SIZE - 1);
-    new_var->value[VALUE_SIZE - 1] = '\0';
-    new_var->next = variables_head;
-    variables_head = new_var;
+    return hash;
 }
 
-// Function to get a variable's value
-char* get_variable(const char *name) {
-    Variable *current = variables_head;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            return current->value;
+// Function to find the symbol table slot for a name (either its entry or an empty slot)
+Symbol** symbol_slot(const char *name, size_t length, uint32_t hash) {
+    size_t mask = symbol_capacity - 1;
+    size_t i = hash & mask;
+    while (symbols[i] != NULL) {
+        Symbol *sym = symbols[i];
+        if (sym->hash == hash && sym->length == length && memcmp(sym->name, name, length) == 0) {
+            break;
         }
-        current = current->next;
+        i = (i + 1) & mask;
     }
-    return NULL; // Variable not found
+    return &symbols[i];
 }
 
-// Function to store a function definition
-void store_function(const char *name, const char *code) {
-    Function *current = functions_head;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            free(current->code);
-            current->code = strdup(code);
-            return;
+// Function to intern a name, returning the unique symbol for it
+const Symbol* intern_symbol(const char *name, size_t length) {
+    // Grow the table before it gets more than 3/4 full
+    if ((symbol_count + 1) * 4 > symbol_capacity * 3) {
+        size_t old_capacity = symbol_capacity;
+        Symbol **old_symbols = symbols;
+        symbol_capacity = old_capacity ? old_capacity * 2 : TABLE_MIN_CAPACITY;
+        symbols = (Symbol **)calloc(symbol_capacity, sizeof(Symbol *));
+        if (symbols == NULL) {
+            fprintf(stderr, "Memory allocation failed for symbol table.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_symbols[i] != NULL) {
+                *symbol_slot(old_symbols[i]->name, old_symbols[i]->length, old_symbols[i]->hash) = old_symbols[i];
+            }
         }
-        current = current->next;
+        free(old_symbols);
     }
-    // Create a new function if it doesn't exist
-    Function *new_func = (Function *)malloc(sizeof(Function));
-    if (new_func == NULL) {
-        fprintf(stderr, "Memory allocation failed for function.\n");
-        exit(EXIT_FAILURE);
+
+    uint32_t hash = hash_name(name, length);
+    Symbol **slot = symbol_slot(name, length, hash);
+    if (*slot == NULL) {
+        Symbol *sym = (Symbol *)malloc(sizeof(Symbol) + length + 1);
+        if (sym == NULL) {
+            fprintf(stderr, "Memory allocation failed for symbol.\n");
+            exit(EXIT_FAILURE);
+        }
+        sym->hash = hash;
+        sym->length = (uint32_t)length;
+        memcpy(sym->name, name, length);
+        sym->name[length] = '\0';
+        *slot = sym;
+        symbol_count++;
     }
-    strncpy(new_func->name, name, NAME_SIZE - 1);
-    new_func->name[NAME_SIZE - 1] = '\0';
-    new_func->code = strdup(code);
-    if (new_func->code == NULL) {
-        fprintf(stderr, "Memory allocation failed for function code.\n");
-        free(new_func);
-        exit(EXIT_FAILURE);
+    return *slot;
+}
+
+// Function to find the index entry for a symbol (either its entry or an empty one)
+VariableEntry* variable_entry(const Symbol *sym) {
+    size_t mask = variable_index_capacity - 1;
+    size_t i = sym->hash & mask;
+    while (variable_index[i].symbol != NULL && variable_index[i].symbol != sym) {
+        i = (i + 1) & mask;
     }
-    new_func->next = functions_head;
-    functions_head = new_func;
+    return &variable_index[i];
 }
 
-// Function to get a function's code by name
-char* get_function_code(const char *name) {
-    Function *current = functions_head;
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            return current->code;
+// Function to resolve a variable name to its slot, allocating an undefined slot if needed
+uint32_t resolve_variable(const char *name, size_t length) {
+    // Grow the index before it gets more than 3/4 full
+    if ((variable_count + 1) * 4 > variable_index_capacity * 3) {
+        size_t old_capacity = variable_index_capacity;
+        VariableEntry *old_index = variable_index;
+        variable_index_capacity = old_capacity ? old_capacity * 2 : TABLE_MIN_CAPACITY;
+        variable_index = (VariableEntry *)calloc(variable_index_capacity, sizeof(VariableEntry));
+        if (variable_index == NULL) {
+            fprintf(stderr, "Memory allocation failed for variable.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_index[i].symbol != NULL) {
+                *variable_entry(old_index[i].symbol) = old_index[i];
+            }
         }
-        current = current->next;
+        free(old_index);
+    }
+
+    const Symbol *sym = intern_symbol(name, length);
+    VariableEntry *entry = variable_entry(sym);
+    if (entry->symbol != NULL) {
+        return entry->slot;
     }
-    return NULL; // Function not found
-}
 
-// Function to trim leading and trailing whitespace and semicolons
-char* trim(char *str) {
-    if (str == NULL) return NULL;
+    // Create a new variable slot if it doesn't exist
+    if (variable_count == variable_slot_capacity) {
+        size_t new_capacity = variable_slot_capacity ? variable_slot_capacity * 2 : TABLE_MIN_CAPACITY;
+        Variable *new_slots = (Variable *)realloc(variable_slots, new_capacity * sizeof(Variable));
+        if (new_slots == NULL) {
+            fprintf(stderr, "Memory allocation failed for variable.\n");
+            exit(EXIT_FAILURE);
+        }
+        variable_slots = new_slots;
+        variable_slot_capacity = new_capacity;
+    }
+    Variable *var = &variable_slots[variable_count];
+    var->symbol = sym;
+    var->defined = 0;
+    memset(&var->value, 0, sizeof(var->value));
+    entry->symbol = sym;
+    entry->slot = (uint32_t)variable_count;
+    return (uint32_t)variable_count++;
+}
 
-    // Trim leading whitespace
-    while (*str == ' ' || *str == '\t') str++;
+// Function to store a value of known length into a variable slot
+void assign_variable(uint32_t slot, const char *value, size_t length) {
+    Variable *var = &variable_slots[slot];
+    string_assign(&var->value, value, length);
+    var->defined = 1;
+}
 
-    // Trim trailing whitespace and semicolons
-    char *end = str + strlen(str) - 1;
-    while (end > str && (*end == ' ' || *end == '\n' || *end == ';')) end--;
-    *(end + 1) = '\0';
+// Function to find a function's slot by name, creating an undefined slot if needed
+uint32_t resolve_function(const char *name, size_t length) {
+    const Symbol *sym = intern_symbol(name, length);
+    for (size_t i = 0; i < function_count; i++) {
+        if (functions[i].symbol == sym) {
+            return (uint32_t)i;
+        }
+    }
+    if (function_count == function_capacity) {
+        size_t new_capacity = function_capacity ? function_capacity * 2 : 16;
+        Function *new_functions = (Function *)realloc(functions, new_capacity * sizeof(Function));
+        if (new_functions == NULL) {
+            fprintf(stderr, "Memory allocation failed for function.\n");
+            exit(EXIT_FAILURE);
+        }
+        functions = new_functions;
+        function_capacity = new_capacity;
+    }
+    Function *new_func = &functions[function_count];
+    new_func->symbol = sym;
+    new_func->body = NULL;
+    return (uint32_t)function_count++;
+}
 
-    return str;
+// Function to keep a compiled function body alive until cleanup and return its index
+uint32_t add_function_body(Bytecode *body) {
+    if (function_body_count == function_body_capacity) {
+        size_t new_capacity = function_body_capacity ? function_body_capacity * 2 : 16;
+        Bytecode **new_bodies = (Bytecode **)realloc(function_bodies, new_capacity * sizeof(Bytecode *));
+        if (new_bodies == NULL) {
+            fprintf(stderr, "Memory allocation failed for function code.\n");
+            exit(EXIT_FAILURE);
+        }
+        function_bodies = new_bodies;
+        function_body_capacity = new_capacity;
+    }
+    function_bodies[function_body_count] = body;
+    return (uint32_t)function_body_count++;
 }
 
 // Function to compile a shader
@@ -224,52 +1166,6 @@ GLuint create_shader_program(const char* vertexSource, const char* fragmentSourc
 
 // Function to set up OpenGL objects (e.g., VAO, VBO)
 void setup_opengl_objects() {
-    // Define vertices for a cube
-    float vertices[] = {
-        // positions
-        -0.5f, -0.5f, -0.5f,
-         0.5f, -0.5f, -0.5f,
-         0.5f,  0.5f, -0.5f,
-         0.5f,  0.5f, -0.5f,
-        -0.5f,  0.5f, -0.5f,
-        -0.5f, -0.5f, -0.5f,
-
-        -0.5f, -0.5f,  0.5f,
-         0.5f, -0.5f,  0.5f,
-         0.5f,  0.5f,  0.5f,
-         0.5f,  0.5f,  0.5f,
-        -0.5f,  0.5f,  0.5f,
-        -0.5f, -0.5f,  0.5f,
-
-        -0.5f,  0.5f,  0.5f,
-        -0.5f,  0.5f, -0.5f,
-        -0.5f, -0.5f, -0.5f,
-        -0.5f, -0.5f, -0.5f,
-        -0.5f, -0.5f,  0.5f,
-        -0.5f,  0.5f,  0.5f,
-
-         0.5f,  0.5f,  0.5f,
-         0.5f,  0.5f, -0.5f,
-         0.5f, -0.5f, -0.5f,
-         0.5f, -0.5f, -0.5f,
-         0.5f, -0.5f,  0.5f,
-         0.5f,  0.5f,  0.5f,
-
-        -0.5f, -0.5f, -0.5f,
-         0.5f, -0.5f, -0.5f,
-         0.5f, -0.5f,  0.5f,
-         0.5f, -0.5f,  0.5f,
-        -0.5f, -0.5f,  0.5f,
-        -0.5f, -0.5f, -0.5f,
-
-        -0.5f,  0.5f, -0.5f,
-         0.5f,  0.5f, -0.5f,
-         0.5f,  0.5f,  0.5f,
-         0.5f,  0.5f,  0.5f,
-        -0.5f,  0.5f,  0.5f,
-        -0.5f,  0.5f, -0.5f
-    };
-
     // Generate and bind VAO and VBO
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -277,42 +1173,190 @@ void setup_opengl_objects() {
     glBindVertexArray(VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
 
     // Define vertex attribute pointers
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
+    // Instanced variant of the cube: same vertices, plus one block offset and type per instance
+    glGenVertexArrays(1, &instance_VAO);
+    glGenBuffers(1, &instance_VBO);
+    glBindVertexArray(instance_VAO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
     // Unbind VAO and VBO
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 
+    // VAOs without an offset or type array read these constants instead
+    glVertexAttrib3f(1, 0.0f, 0.0f, 0.0f);
+    glVertexAttrib1f(2, (float)BLOCK_DEFAULT);
+
     // Define shader sources
     const char* vertexShaderSource = "#version 330 core\n"
         "layout (location = 0) in vec3 aPos;\n"
+        "layout (location = 1) in vec3 aOffset;\n"
+        "layout (location = 2) in float aType;\n"
         "uniform mat4 model;\n"
-        "uniform mat4 view;\n"
-        "uniform mat4 projection;\n"
+        "uniform vec3 palette[16];\n"
+        "out vec3 blockColor;\n"
+        "layout (std140) uniform Camera {\n"
+        "   mat4 view;\n"
+        "   mat4 projection;\n"
+        "};\n"
         "void main()\n"
         "{\n"
-        "   gl_Position = projection * view * model * vec4(aPos, 1.0);\n"
+        "   gl_Position = projection * view * model * vec4(aPos + aOffset, 1.0);\n"
+        "   blockColor = palette[int(aType) & 15];\n"
         "}\0";
 
     const char* fragmentShaderSource = "#version 330 core\n"
+        "in vec3 blockColor;\n"
         "out vec4 FragColor;\n"
-        "uniform vec3 objectColor;\n"
         "uniform vec3 lightColor;\n"
         "void main()\n"
         "{\n"
-        "   FragColor = vec4(lightColor * objectColor, 1.0);\n"
+        "   FragColor = vec4(lightColor * blockColor, 1.0);\n"
         "}\n\0";
 
     // Create shader program
     shaderProgram = create_shader_program(vertexShaderSource, fragmentShaderSource);
+
+    // Resolve uniform locations once instead of by name every frame
+    uniform_model = glGetUniformLocation(shaderProgram, "model");
+    uniform_palette = glGetUniformLocation(shaderProgram, "palette");
+    uniform_light_color = glGetUniformLocation(shaderProgram, "lightColor");
+
+    // The model matrix is the identity except while drawing per voxel, and the colours never change
+    const float identity[16] = {
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, 1, 0,
+        0, 0, 0, 1
+    };
+    glUseProgram(shaderProgram);
+    glUniformMatrix4fv(uniform_model, 1, GL_FALSE, identity);
+    glUniform3fv(uniform_palette, BLOCK_TYPE_COUNT, &block_palette[0][0]); // Colour per block type
+    glUniform3f(uniform_light_color, 1.0f, 1.0f, 1.0f);  // White light
+
+    // Nearest surface wins, whatever order chunks and faces are drawn in
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    // Camera matrices live in a uniform buffer that is rewritten only when the player moves
+    GLuint camera_block = glGetUniformBlockIndex(shaderProgram, "Camera");
+    if (camera_block != GL_INVALID_INDEX) glUniformBlockBinding(shaderProgram, camera_block, CAMERA_BINDING);
+    glGenBuffers(1, &camera_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, 32 * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, camera_UBO);
+    camera_dirty = 1;
     opengl_initialized = 1; // Indicate that OpenGL has been initialized
 }
 
-// Function to draw the scene (render all voxels)
+// Function to upload the position and type of every block to the instance buffer
+void upload_instances(void) {
+    MeshBuffer *offsets = &mesh_scratch;
+    offsets->count = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        Chunk *chunk = chunks[i];
+        for (int index = 0; index < CHUNK_VOLUME; index++) {
+            uint16_t type = chunk_get(chunk, index);
+            if (type == BLOCK_AIR) continue;
+            float instance[4] = {
+                (float)(chunk->cx * CHUNK_SIZE + (index & CHUNK_MASK)),
+                (float)(chunk->cy * CHUNK_SIZE + (index >> (2 * CHUNK_SHIFT))),
+                (float)(chunk->cz * CHUNK_SIZE + ((index >> CHUNK_SHIFT) & CHUNK_MASK)),
+                (float)type
+            };
+            mesh_append(offsets, instance, 4);
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instance_VBO);
+    glBufferData(GL_ARRAY_BUFFER, offsets->count * sizeof(float), offsets->data, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    instance_count = (uint32_t)(offsets->count / 4);
+    instances_dirty = 0;
+}
+
+// Function to multiply two column-major 4x4 matrices (out = a * b)
+void matrix_multiply(const float *a, const float *b, float *out) {
+    for (int col = 0; col < 4; col++) {
+        for (int row = 0; row < 4; row++) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; k++) sum += a[k * 4 + row] * b[col * 4 + k];
+            out[col * 4 + row] = sum;
+        }
+    }
+}
+
+// Function to extract the six frustum planes (ax + by + cz + d >= 0 inside) from a view-projection matrix
+void frustum_planes(const float *m, float planes[6][4]) {
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            float sign = side ? -1.0f : 1.0f;
+            float *plane = planes[axis * 2 + side];
+            for (int k = 0; k < 4; k++) {
+                plane[k] = m[k * 4 + 3] + sign * m[k * 4 + axis];
+            }
+        }
+    }
+}
+
+// Function to test whether any part of a chunk's bounding box lies inside the frustum
+int chunk_in_frustum(const Chunk *chunk, const float planes[6][4]) {
+    float lo[3] = {
+        chunk->cx * CHUNK_SIZE - 0.5f, chunk->cy * CHUNK_SIZE - 0.5f, chunk->cz * CHUNK_SIZE - 0.5f
+    };
+    for (int i = 0; i < 6; i++) {
+        const float *p = planes[i];
+
+        // The box corner furthest along the plane normal; if it is outside, the whole box is
+        float x = lo[0] + (p[0] > 0 ? CHUNK_SIZE : 0);
+        float y = lo[1] + (p[1] > 0 ? CHUNK_SIZE : 0);
+        float z = lo[2] + (p[2] > 0 ? CHUNK_SIZE : 0);
+        if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0) return 0;
+    }
+    return 1;
+}
+
+// Function to upload the view and projection to the camera uniform block and recompute the frustum
+void update_camera(void) {
+    // View and projection, laid out as the std140 block 'Camera' expects
+    float camera[32] = {
+        // View: translate the world opposite to the player
+        1, 0, 0, 0,
+        0, 1, 0, 0,
+        0, 0, 1, 0,
+        -player_x, -player_y, -player_z, 1,
+        // Perspective projection: 60 degree vertical field of view, 4:3 aspect, near 0.1, far 100
+        1.29904f, 0, 0, 0,
+        0, 1.73205f, 0, 0,
+        0, 0, -1.002f, -1,
+        0, 0, -0.2002f, 0
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(camera), camera);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Frustum planes of the combined view-projection, for skipping chunks out of sight
+    float view_projection[16];
+    matrix_multiply(camera + 16, camera, view_projection);
+    frustum_planes(view_projection, frustum);
+    camera_dirty = 0;
+}
+
+// Function to draw the scene in the current render mode
 void neko_draw_scene() {
     if (!opengl_initialized) {
         fprintf(stderr, "OpenGL not initialized. Cannot draw.\n");
@@ -326,130 +1370,2230 @@ void neko_draw_scene() {
     // Use the shader program
     glUseProgram(shaderProgram);
 
-    // Define transformation matrices (simplified; consider using GLM for complex transformations)
-    float model[16] = {
-        1, 0, 0, 0,
-        0, 1, 0, 0,
-        0, 0, 1, 0,
-        0, 0, 0, 1
-    };
-    float view[16] = {
-        1, 0, 0, 0,
-        0, 1, 0, 0,
-        0, 0, 1, 0,
-        -player_x, -player_y, -player_z, 1
-    };
-    float projection[16] = {
-        1.29904f, 0, 0, 0,
-        0, 1.73205f, 0, 0,
-        0, 0, -1.002f, -0.2002f,
-        0, 0, -1, 0
-    };
+    // Refresh the camera uniform block and frustum planes only after the player moved
+    if (camera_dirty) update_camera();
 
-    // Pass matrices to shader
-    GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint viewLoc  = glGetUniformLocation(shaderProgram, "view");
-    GLint projLoc  = glGetUniformLocation(shaderProgram, "projection");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, model);
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, view);
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, projection);
-
-    // Set object and light colors
-    GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
-    GLint lightColorLoc  = glGetUniformLocation(shaderProgram, "lightColor");
-    glUniform3f(objectColorLoc, 0.4f, 0.8f, 0.4f); // Green for blocks
-    glUniform3f(lightColorLoc, 1.0f, 1.0f, 1.0f);  // White light
-
-    // Bind VAO and draw each voxel
-    glBindVertexArray(VAO);
-    Voxel *current = voxels_head;
-    while (current != NULL) {
-        // Compute model matrix for each voxel
-        float model_matrix[16] = {
-            1, 0, 0, 0,
-            0, 1, 0, 0,
-            0, 0, 1, 0,
-            current->x, current->y, current->z, 1
-        };
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, model_matrix);
-
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        current = current->next;
+    // Stream chunks around the player, then bring a bounded number of edited chunks up to date;
+    // the rest keep their old mesh for now
+    double remesh_start = now_seconds();
+    if (world_stream_radius > 0) stream_update();
+    if (render_mode == RENDER_CHUNKED) remesh_dirty_chunks();
+    frame_remesh_time = now_seconds() - remesh_start;
+
+    chunks_drawn = chunks_culled = 0;
+    switch (render_mode) {
+        case RENDER_CHUNKED:
+            // Draw each visible chunk's mesh with one call
+            for (size_t i = 0; i < chunk_count; i++) {
+                Chunk *chunk = chunks[i];
+                if (!chunk_in_frustum(chunk, frustum)) {
+                    chunks_culled++;
+                    continue;
+                }
+                chunks_drawn++;
+                if (chunk->vertex_count == 0) continue;
+                glBindVertexArray(chunk->vao);
+                glDrawArrays(GL_TRIANGLES, 0, (GLsizei)chunk->vertex_count);
+            }
+            break;
+
+        case RENDER_INSTANCED:
+            // Draw every block with a single call, re-uploading the offsets when blocks changed.
+            // The offsets are one buffer, so this mode does not cull.
+            if (instances_dirty) upload_instances();
+            chunks_drawn = chunk_count;
+            glBindVertexArray(instance_VAO);
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 36, (GLsizei)instance_count);
+            break;
+
+        case RENDER_PER_VOXEL: {
+            // Draw each block on its own, moving the cube with the model matrix
+            float model[16] = {
+                1, 0, 0, 0,
+                0, 1, 0, 0,
+                0, 0, 1, 0,
+                0, 0, 0, 1
+            };
+            glBindVertexArray(VAO);
+            for (size_t i = 0; i < chunk_count; i++) {
+                Chunk *chunk = chunks[i];
+                if (!chunk_in_frustum(chunk, frustum)) {
+                    chunks_culled++;
+                    continue;
+                }
+                chunks_drawn++;
+                for (int index = 0; index < CHUNK_VOLUME; index++) {
+                    uint16_t type = chunk_get(chunk, index);
+                    if (type == BLOCK_AIR) continue;
+                    glVertexAttrib1f(2, (float)type);
+                    model[12] = (float)(chunk->cx * CHUNK_SIZE + (index & CHUNK_MASK));
+                    model[13] = (float)(chunk->cy * CHUNK_SIZE + (index >> (2 * CHUNK_SHIFT)));
+                    model[14] = (float)(chunk->cz * CHUNK_SIZE + ((index >> CHUNK_SHIFT) & CHUNK_MASK));
+                    glUniformMatrix4fv(uniform_model, 1, GL_FALSE, model);
+                    glDrawArrays(GL_TRIANGLES, 0, 36);
+                }
+            }
+
+            // The other modes draw in world space
+            model[12] = model[13] = model[14] = 0;
+            glUniformMatrix4fv(uniform_model, 1, GL_FALSE, model);
+            glVertexAttrib1f(2, (float)BLOCK_DEFAULT);
+            break;
+        }
     }
     glBindVertexArray(0);
 }
 
-// Function to add a block
-void neko_add_block(float x, float y, float z) {
-    // Check if the block already exists
-    Voxel *current = voxels_head;
-    while (current != NULL) {
-        if (current->x == x && current->y == y && current->z == z) {
-            printf("Block already present at (%.1f, %.1f, %.1f).\n", x, y, z);
-            return;
-        }
-        current = current->next;
-    }
+// Function to pack grid coordinates into a single map key
+uint64_t pack_coords(int32_t x, int32_t y, int32_t z) {
+    const uint64_t mask = (1u << COORD_BITS) - 1;
+    return (((uint64_t)(x + COORD_LIMIT) & mask) << (2 * COORD_BITS)) |
+           (((uint64_t)(y + COORD_LIMIT) & mask) << COORD_BITS) |
+           ((uint64_t)(z + COORD_LIMIT) & mask);
+}
 
-    // Add a new block
-    Voxel *new_voxel = (Voxel *)malloc(sizeof(Voxel));
-    if (new_voxel == NULL) {
-        fprintf(stderr, "Memory allocation failed for voxel.\n");
-        exit(EXIT_FAILURE);
+// Function to spread a packed key over the table (splitmix64 finalizer)
+size_t coord_hash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return (size_t)key;
+}
+
+// Function to find the slot holding a key, or the empty slot where it would go
+size_t coord_map_slot(const CoordMap *map, uint64_t key) {
+    size_t mask = map->capacity - 1;
+    size_t i = coord_hash(key) & mask;
+    while (map->keys[i] != COORD_EMPTY && map->keys[i] != key) {
+        i = (i + 1) & mask;
     }
-    new_voxel->x = x;
-    new_voxel->y = y;
-    new_voxel->z = z;
-    new_voxel->next = voxels_head;
-    voxels_head = new_voxel;
+    return i;
+}
 
-    if (verbose) printf("Block added at (%.1f, %.1f, %.1f).\n", x, y, z);
+// Function to look up the value stored for a key
+uint32_t coord_map_find(const CoordMap *map, uint64_t key) {
+    if (map->count == 0) return COORD_NOT_FOUND;
+    size_t i = coord_map_slot(map, key);
+    return map->keys[i] == key ? map->values[i] : COORD_NOT_FOUND;
 }
 
-// Function to remove a block
-void neko_remove_block(float x, float y, float z) {
-    Voxel *current = voxels_head;
-    Voxel *prev = NULL;
-    while (current != NULL) {
-        if (current->x == x && current->y == y && current->z == z) {
-            if (prev == NULL) {
-                voxels_head = current->next;
-            } else {
-                prev->next = current->next;
+// Function to insert or update a key
+void coord_map_insert(CoordMap *map, uint64_t key, uint32_t value) {
+    // Grow the table before it gets more than 3/4 full
+    if ((map->count + 1) * 4 > map->capacity * 3) {
+        CoordMap old = *map;
+        map->capacity = old.capacity ? old.capacity * 2 : TABLE_MIN_CAPACITY;
+        map->keys = (uint64_t *)malloc(map->capacity * sizeof(uint64_t));
+        map->values = (uint32_t *)malloc(map->capacity * sizeof(uint32_t));
+        if (map->keys == NULL || map->values == NULL) {
+            fprintf(stderr, "Memory allocation failed for coordinate map.\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(map->keys, 0xff, map->capacity * sizeof(uint64_t)); // All COORD_EMPTY
+        for (size_t i = 0; i < old.capacity; i++) {
+            if (old.keys[i] != COORD_EMPTY) {
+                size_t slot = coord_map_slot(map, old.keys[i]);
+                map->keys[slot] = old.keys[i];
+                map->values[slot] = old.values[i];
             }
-            free(current);
-            if (verbose) printf("Block removed at (%.1f, %.1f, %.1f).\n", x, y, z);
-            return;
         }
-        prev = current;
-        current = current->next;
+        free(old.keys);
+        free(old.values);
+    }
+
+    size_t i = coord_map_slot(map, key);
+    if (map->keys[i] == COORD_EMPTY) {
+        map->keys[i] = key;
+        map->count++;
     }
-    printf("No block found at (%.1f, %.1f, %.1f).\n", x, y, z);
+    map->values[i] = value;
 }
 
-// Function to create an OpenGL window
-void neko_window(const char *title, int width, int height) {
-    if (!glfwInit()) {
-        fprintf(stderr, "GLFW initialization failed.\n");
-        exit(EXIT_FAILURE);
+// Function to remove a key, shifting later entries back so no tombstones are needed
+void coord_map_remove(CoordMap *map, uint64_t key) {
+    if (map->count == 0) return;
+    size_t mask = map->capacity - 1;
+    size_t hole = coord_map_slot(map, key);
+    if (map->keys[hole] != key) return;
+
+    size_t i = hole;
+    for (;;) {
+        i = (i + 1) & mask;
+        if (map->keys[i] == COORD_EMPTY) break;
+        // Move the entry into the hole unless its home slot lies cyclically in (hole, i]
+        size_t home = coord_hash(map->keys[i]) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            map->keys[hole] = map->keys[i];
+            map->values[hole] = map->values[i];
+            hole = i;
+        }
     }
+    map->keys[hole] = COORD_EMPTY;
+    map->count--;
+}
 
-    // Configure GLFW for OpenGL 3.3 Core Profile
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE); // Enable double buffering
+// Function to release a coordinate map
+void coord_map_free(CoordMap *map) {
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(*map));
+}
 
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // Necessary for Mac
-#endif
+// Function to locate a block inside its chunk's block array
+int chunk_block_index(int32_t x, int32_t y, int32_t z) {
+    return (x & CHUNK_MASK) | ((z & CHUNK_MASK) << CHUNK_SHIFT) | ((y & CHUNK_MASK) << (2 * CHUNK_SHIFT));
+}
 
-    // Create the GLFW window
-    gl_window = glfwCreateWindow(width, height, title, NULL, NULL);
-    if (!gl_window) {
-        fprintf(stderr, "Failed to create GLFW window.\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+// Function to take a group of 8 nodes, reusing a freed one when possible; returns its index
+uint32_t octree_alloc_group(Octree *tree) {
+    if (tree->free_group != OCTREE_NONE) {
+        uint32_t group = tree->free_group;
+        tree->free_group = tree->nodes[group];
+        tree->free_nodes -= 8;
+        return group;
+    }
+    if (tree->count + 8 > tree->capacity) {
+        uint32_t new_capacity = tree->capacity ? tree->capacity * 2 : 64;
+        while (new_capacity < tree->count + 8) new_capacity *= 2;
+        uint32_t *new_nodes = (uint32_t *)realloc(tree->nodes, new_capacity * sizeof(uint32_t));
+        if (new_nodes == NULL) {
+            fprintf(stderr, "Memory allocation failed for octree.\n");
+            exit(EXIT_FAILURE);
+        }
+        tree->nodes = new_nodes;
+        tree->capacity = new_capacity;
+    }
+    uint32_t group = tree->count;
+    tree->count += 8;
+    return group;
+}
+
+// Function to make an octree of one uniform chunk
+void octree_init(Octree *tree, uint16_t id) {
+    tree->nodes = (uint32_t *)malloc(sizeof(uint32_t));
+    if (tree->nodes == NULL) {
+        fprintf(stderr, "Memory allocation failed for octree.\n");
+        exit(EXIT_FAILURE);
+    }
+    tree->nodes[0] = OCTREE_LEAF | id;
+    tree->count = tree->capacity = 1;
+    tree->free_group = OCTREE_NONE;
+    tree->free_nodes = 0;
+}
+
+// Function to release an octree
+void octree_free(Octree *tree) {
+    free(tree->nodes);
+    memset(tree, 0, sizeof(*tree));
+}
+
+// Function to pick the child of a node covering (x, y, z); half is half the node's edge length
+int octree_child(int x, int y, int z, int half) {
+    return ((x & half) ? 1 : 0) | ((y & half) ? 2 : 0) | ((z & half) ? 4 : 0);
+}
+
+// Function to read one block of an octree
+uint16_t octree_get(const Octree *tree, int index) {
+    int x = index & CHUNK_MASK, z = (index >> CHUNK_SHIFT) & CHUNK_MASK, y = index >> (2 * CHUNK_SHIFT);
+    uint32_t node = tree->nodes[0];
+    for (int half = CHUNK_SIZE / 2; !(node & OCTREE_LEAF); half >>= 1) {
+        node = tree->nodes[node + octree_child(x, y, z, half)];
+    }
+    return (uint16_t)node;
+}
+
+// Function to copy the subtree of a node into a new node array, groups in depth-first order;
+// returns the node's value in the new array
+uint32_t octree_copy(const Octree *tree, uint32_t node, uint32_t *nodes, uint32_t *count) {
+    if (node & OCTREE_LEAF) return node;
+    uint32_t group = *count;
+    *count += 8;
+    for (int i = 0; i < 8; i++) {
+        nodes[group + i] = octree_copy(tree, tree->nodes[node + i], nodes, count);
+    }
+    return group;
+}
+
+// Function to drop an octree's freed groups and spare capacity, so its memory follows the live nodes
+void octree_compact(Octree *tree) {
+    if (tree->free_nodes == 0 && tree->count == tree->capacity) return;
+    uint32_t live = tree->count - tree->free_nodes;
+    uint32_t *nodes = (uint32_t *)malloc(live * sizeof(uint32_t));
+    if (nodes == NULL) {
+        fprintf(stderr, "Memory allocation failed for octree.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t count = 1;
+    nodes[0] = octree_copy(tree, tree->nodes[0], nodes, &count);
+    free(tree->nodes);
+    tree->nodes = nodes;
+    tree->count = tree->capacity = live;
+    tree->free_group = OCTREE_NONE;
+    tree->free_nodes = 0;
+}
+
+// Function to write one block of an octree: leaves on the way down are split, and groups whose
+// children end up as the same leaf are collapsed on the way back (see octree_compact())
+void octree_set(Octree *tree, int index, uint16_t id) {
+    int x = index & CHUNK_MASK, z = (index >> CHUNK_SHIFT) & CHUNK_MASK, y = index >> (2 * CHUNK_SHIFT);
+    uint32_t path[CHUNK_SHIFT]; // Slot of each node passed through, root first
+    int depth = 0;
+    uint32_t slot = 0;
+    for (int half = CHUNK_SIZE / 2; half > 0; half >>= 1) {
+        path[depth++] = slot;
+        uint32_t node = tree->nodes[slot];
+        if (node & OCTREE_LEAF) {
+            if ((uint16_t)node == id) return;
+            uint32_t group = octree_alloc_group(tree);
+            for (int i = 0; i < 8; i++) tree->nodes[group + i] = node;
+            tree->nodes[slot] = group;
+            node = group;
+        }
+        slot = node + (uint32_t)octree_child(x, y, z, half);
+    }
+    tree->nodes[slot] = OCTREE_LEAF | id;
+
+    while (depth-- > 0) {
+        uint32_t parent = path[depth], group = tree->nodes[parent];
+        uint32_t first = tree->nodes[group];
+        int uniform = (first & OCTREE_LEAF) != 0;
+        for (int i = 1; uniform && i < 8; i++) {
+            uniform = tree->nodes[group + i] == first;
+        }
+        if (!uniform) break;
+        tree->nodes[parent] = first;
+        tree->nodes[group] = tree->free_group;
+        tree->free_group = group;
+        tree->free_nodes += 8;
+    }
+}
+
+// Function to build the node for a cube of a flat block array. Groups are taken from the end of the
+// node array, so a group whose children all collapse is always the last one and is simply dropped.
+uint32_t octree_build(Octree *tree, const uint16_t *blocks, int x0, int y0, int z0, int size) {
+    if (size == 1) return OCTREE_LEAF | blocks[chunk_block_index(x0, y0, z0)];
+    int half = size / 2;
+    uint32_t group = octree_alloc_group(tree);
+    for (int i = 0; i < 8; i++) {
+        uint32_t node = octree_build(tree, blocks, x0 + (i & 1 ? half : 0), y0 + (i & 2 ? half : 0),
+                                     z0 + (i & 4 ? half : 0), half);
+        tree->nodes[group + i] = node;
+    }
+    uint32_t first = tree->nodes[group];
+    if (!(first & OCTREE_LEAF)) return group;
+    for (int i = 1; i < 8; i++) {
+        if (tree->nodes[group + i] != first) return group;
+    }
+    tree->count = group;
+    return first;
+}
+
+// Function to build an octree holding a flat block array, trimmed to the nodes it uses
+void octree_from_blocks(Octree *tree, const uint16_t *blocks) {
+    memset(tree, 0, sizeof(*tree));
+    tree->free_group = OCTREE_NONE;
+    tree->count = 1; // The root slot; groups follow it
+    tree->capacity = 0;
+    uint32_t root = octree_build(tree, blocks, 0, 0, 0, CHUNK_SIZE);
+    if (tree->nodes == NULL || tree->count < tree->capacity) {
+        uint32_t *trimmed = (uint32_t *)realloc(tree->nodes, tree->count * sizeof(uint32_t));
+        if (trimmed == NULL) {
+            fprintf(stderr, "Memory allocation failed for octree.\n");
+            exit(EXIT_FAILURE);
+        }
+        tree->nodes = trimmed;
+        tree->capacity = tree->count;
+    }
+    tree->nodes[0] = root;
+}
+
+// Function to write the blocks of an octree node's cube into a flat block array
+void octree_fill(const Octree *tree, uint32_t node, int x0, int y0, int z0, int size, uint16_t *blocks) {
+    if (node & OCTREE_LEAF) {
+        for (int y = y0; y < y0 + size; y++) {
+            for (int z = z0; z < z0 + size; z++) {
+                uint16_t *row = &blocks[chunk_block_index(x0, y, z)];
+                for (int x = 0; x < size; x++) row[x] = (uint16_t)node;
+            }
+        }
+        return;
+    }
+    int half = size / 2;
+    for (int i = 0; i < 8; i++) {
+        octree_fill(tree, tree->nodes[node + i], x0 + (i & 1 ? half : 0), y0 + (i & 2 ? half : 0),
+                    z0 + (i & 4 ? half : 0), half, blocks);
+    }
+}
+
+// Function to pack a flat block array as palette indices of the narrowest width that fits
+void palette_from_blocks(PaletteBlocks *palette, const uint16_t *blocks) {
+    int slot_of[BLOCK_TYPE_COUNT];
+    uint16_t ids[BLOCK_TYPE_COUNT];
+    int count = 0;
+    for (int i = 0; i < BLOCK_TYPE_COUNT; i++) slot_of[i] = -1;
+    for (int i = 0; i < CHUNK_VOLUME; i++) {
+        if (slot_of[blocks[i]] < 0) {
+            slot_of[blocks[i]] = count;
+            ids[count++] = blocks[i];
+        }
+    }
+
+    int bits = 0;
+    while ((1 << bits) < count) bits = bits ? bits * 2 : 1;
+    palette->ids = (uint16_t *)malloc((size_t)count * sizeof(uint16_t));
+    palette->words = bits ? (uint64_t *)calloc(CHUNK_VOLUME * bits / 64, sizeof(uint64_t)) : NULL;
+    if (palette->ids == NULL || (bits && palette->words == NULL)) {
+        fprintf(stderr, "Memory allocation failed for chunk palette.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(palette->ids, ids, (size_t)count * sizeof(uint16_t));
+    palette->count = (uint16_t)count;
+    palette->bits = (uint8_t)bits;
+    if (bits == 0) return;
+    for (int i = 0; i < CHUNK_VOLUME; i++) {
+        size_t bit = (size_t)i * bits;
+        palette->words[bit >> 6] |= (uint64_t)slot_of[blocks[i]] << (bit & 63);
+    }
+}
+
+// Function to release a chunk palette
+void palette_free(PaletteBlocks *palette) {
+    free(palette->ids);
+    free(palette->words);
+    memset(palette, 0, sizeof(*palette));
+}
+
+// Function to read one block of a packed palette
+uint16_t palette_get(const PaletteBlocks *palette, int index) {
+    if (palette->bits == 0) return palette->ids[0];
+    size_t bit = (size_t)index * palette->bits;
+    uint64_t mask = ((uint64_t)1 << palette->bits) - 1;
+    return palette->ids[(palette->words[bit >> 6] >> (bit & 63)) & mask];
+}
+
+// Function to unpack a palette into a flat block array, one word at a time
+void palette_fill(const PaletteBlocks *palette, uint16_t *blocks) {
+    if (palette->bits == 0) {
+        for (int i = 0; i < CHUNK_VOLUME; i++) blocks[i] = palette->ids[0];
+        return;
+    }
+    int bits = palette->bits, per_word = 64 / bits;
+    uint64_t mask = ((uint64_t)1 << bits) - 1;
+    for (int w = 0; w < CHUNK_VOLUME / per_word; w++) {
+        uint64_t word = palette->words[w];
+        for (int i = 0; i < per_word; i++, word >>= bits) {
+            blocks[w * per_word + i] = palette->ids[word & mask];
+        }
+    }
+}
+
+// Function to take a chunk out of the palette cache, leaving its flat copy in place
+void palette_cache_unlink(Chunk *chunk) {
+    if (chunk->lru_prev) chunk->lru_prev->lru_next = chunk->lru_next;
+    else palette_lru_head = chunk->lru_next;
+    if (chunk->lru_next) chunk->lru_next->lru_prev = chunk->lru_prev;
+    else palette_lru_tail = chunk->lru_prev;
+    chunk->lru_prev = chunk->lru_next = NULL;
+    chunk->cached = 0;
+    palette_cache_count--;
+}
+
+// Function to take a chunk out of the palette cache, packing its flat copy again
+void palette_cache_release(Chunk *chunk) {
+    palette_cache_unlink(chunk);
+    palette_from_blocks(&chunk->palette, chunk->blocks);
+    free(chunk->blocks);
+    chunk->blocks = NULL;
+}
+
+// Function to move a cached chunk to the front of the palette cache
+void palette_cache_touch(Chunk *chunk) {
+    if (palette_lru_head == chunk) return;
+    chunk->lru_prev->lru_next = chunk->lru_next;
+    if (chunk->lru_next) chunk->lru_next->lru_prev = chunk->lru_prev;
+    else palette_lru_tail = chunk->lru_prev;
+    chunk->lru_prev = NULL;
+    chunk->lru_next = palette_lru_head;
+    palette_lru_head->lru_prev = chunk;
+    palette_lru_head = chunk;
+}
+
+// Function to give a palette chunk a flat copy for writing, packing the least recently written
+// cached chunks when the cache is full
+void palette_cache_acquire(Chunk *chunk) {
+    uint16_t *blocks = (uint16_t *)malloc(CHUNK_VOLUME * sizeof(uint16_t));
+    if (blocks == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    palette_fill(&chunk->palette, blocks);
+    palette_free(&chunk->palette);
+    chunk->blocks = blocks;
+    chunk->cached = 1;
+    chunk->lru_prev = NULL;
+    chunk->lru_next = palette_lru_head;
+    if (palette_lru_head) palette_lru_head->lru_prev = chunk;
+    else palette_lru_tail = chunk;
+    palette_lru_head = chunk;
+    palette_cache_count++;
+    while (palette_cache_count > palette_cache_size && palette_lru_tail != chunk) {
+        palette_cache_release(palette_lru_tail);
+    }
+}
+
+// Function to read one block of a chunk, unpacking a loaded chunk on first use
+uint16_t chunk_get(Chunk *chunk, int index) {
+    if (chunk->blocks) return chunk->blocks[index];
+    if (chunk->octree.nodes) return octree_get(&chunk->octree, index);
+    if (chunk->palette.ids) return palette_get(&chunk->palette, index);
+    chunk_unpack(chunk);
+    return chunk_get(chunk, index);
+}
+
+// Function to copy all of a chunk's blocks into a flat array, whatever its storage
+void chunk_copy_blocks(Chunk *chunk, uint16_t *out) {
+    if (chunk->blocks == NULL && chunk->octree.nodes == NULL && chunk->palette.ids == NULL) {
+        chunk_unpack(chunk);
+    }
+    if (chunk->blocks) {
+        memcpy(out, chunk->blocks, CHUNK_VOLUME * sizeof(uint16_t));
+    } else if (chunk->octree.nodes) {
+        octree_fill(&chunk->octree, chunk->octree.nodes[0], 0, 0, 0, CHUNK_SIZE, out);
+    } else {
+        palette_fill(&chunk->palette, out);
+    }
+}
+
+// Function to move a chunk's blocks into the storage the world uses (packed chunks are left
+// alone; they are unpacked straight into it)
+void chunk_apply_storage(Chunk *chunk) {
+    WorldStorage current;
+    if (chunk->octree.nodes) current = STORAGE_OCTREE;
+    else if (chunk->palette.ids || chunk->cached) current = STORAGE_PALETTE;
+    else if (chunk->blocks) current = STORAGE_FLAT;
+    else return;
+    if (current == world_storage) return;
+
+    // Take the blocks out as a flat array, then build the new storage from it
+    uint16_t *blocks = chunk->blocks;
+    if (chunk->cached) palette_cache_unlink(chunk);
+    if (blocks == NULL) {
+        if ((blocks = (uint16_t *)malloc(CHUNK_VOLUME * sizeof(uint16_t))) == NULL) {
+            fprintf(stderr, "Memory allocation failed for chunk.\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk_copy_blocks(chunk, blocks);
+    }
+    chunk->blocks = NULL;
+    octree_free(&chunk->octree);
+    palette_free(&chunk->palette);
+
+    if (world_storage == STORAGE_FLAT) {
+        chunk->blocks = blocks;
+        return;
+    }
+    if (world_storage == STORAGE_OCTREE) octree_from_blocks(&chunk->octree, blocks);
+    else palette_from_blocks(&chunk->palette, blocks);
+    free(blocks);
+}
+
+// Function to queue a chunk for remeshing unless it is already waiting
+void chunk_mark_dirty(Chunk *chunk) {
+    if (chunk->dirty) return;
+    chunk->dirty = 1;
+    if (remesh_count == remesh_capacity) {
+        size_t new_capacity = remesh_capacity ? remesh_capacity * 2 : 64;
+        uint64_t *new_queue = (uint64_t *)malloc(new_capacity * sizeof(uint64_t));
+        if (new_queue == NULL) {
+            fprintf(stderr, "Memory allocation failed for remesh queue.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < remesh_count; i++) {
+            new_queue[i] = remesh_queue[(remesh_head + i) % remesh_capacity];
+        }
+        free(remesh_queue);
+        remesh_queue = new_queue;
+        remesh_capacity = new_capacity;
+        remesh_head = 0;
+    }
+    remesh_queue[(remesh_head + remesh_count) % remesh_capacity] = pack_coords(chunk->cx, chunk->cy, chunk->cz);
+    remesh_count++;
+}
+
+// Function to bring queued chunk meshes up to date, oldest edits first, within the per-frame budget.
+// With workers, queued chunks are snapshotted and meshed in the background, and only the uploads
+// of finished meshes count against the budget.
+void remesh_dirty_chunks(void) {
+    chunks_remeshed = 0;
+    if (mesh_thread_count != 0) upload_finished_meshes();
+
+    while (remesh_count > 0) {
+        if (mesh_thread_count == 0 ? (remesh_budget != 0 && chunks_remeshed >= remesh_budget)
+                                   : jobs_in_flight >= MESH_JOBS_IN_FLIGHT) {
+            break;
+        }
+        uint64_t key = remesh_queue[remesh_head];
+        remesh_head = (remesh_head + 1) % remesh_capacity;
+        remesh_count--;
+        uint32_t index = coord_map_find(&chunk_index, key);
+        if (index == COORD_NOT_FOUND || !chunks[index]->dirty) continue;
+        if (mesh_thread_count == 0) {
+            chunk_build_mesh(chunks[index]);
+            chunks_remeshed++;
+        } else {
+            submit_mesh_job(chunks[index]);
+        }
+    }
+}
+
+// Function to write one block of a chunk, keeping its block count and dirty flag up to date
+void chunk_set(Chunk *chunk, int index, uint16_t id) {
+    uint16_t old = chunk_get(chunk, index);
+    if (old == id) return;
+    if (chunk->stored_length) chunk_drop_stored(chunk);
+    // Under a memory cap, storage that grows with the edit counts until the next exact measure
+    size_t before = world_memory_cap > 0 ? chunk_memory(chunk) : 0;
+    chunk->block_count += (id != BLOCK_AIR) - (old != BLOCK_AIR);
+    if (chunk->cached) palette_cache_touch(chunk);
+    else if (chunk->palette.ids) palette_cache_acquire(chunk);
+    if (chunk->blocks) chunk->blocks[index] = id;
+    else octree_set(&chunk->octree, index, id);
+    if (world_memory_cap > 0) resident_bytes += chunk_memory(chunk) - before;
+    chunk_mark_dirty(chunk);
+}
+
+// Function to find the chunk with the given chunk coordinates
+Chunk* find_chunk(int32_t cx, int32_t cy, int32_t cz) {
+    uint32_t index = coord_map_find(&chunk_index, pack_coords(cx, cy, cz));
+    return index == COORD_NOT_FOUND ? NULL : chunks[index];
+}
+
+// Function to add a new chunk to the chunk array and index. Its mesh generation starts at the
+// current counter, so meshes still in flight for an earlier chunk at these coordinates are dropped.
+void add_chunk(Chunk *chunk) {
+    if (chunk_count == chunk_capacity) {
+        size_t new_capacity = chunk_capacity ? chunk_capacity * 2 : 64;
+        Chunk **new_chunks = (Chunk **)realloc(chunks, new_capacity * sizeof(Chunk *));
+        if (new_chunks == NULL) {
+            fprintf(stderr, "Memory allocation failed for chunk.\n");
+            exit(EXIT_FAILURE);
+        }
+        chunks = new_chunks;
+        chunk_capacity = new_capacity;
+    }
+    chunk->mesh_generation = mesh_generation_counter;
+    coord_map_insert(&chunk_index, pack_coords(chunk->cx, chunk->cy, chunk->cz), (uint32_t)chunk_count);
+    chunks[chunk_count++] = chunk;
+    if (world_stream_radius > 0 && world_memory_cap > 0) {
+        resident_bytes += chunk_memory(chunk);
+        stream_hold_cap(chunk);
+    }
+}
+
+// Function to create an empty chunk at the given chunk coordinates
+Chunk* create_chunk(int32_t cx, int32_t cy, int32_t cz) {
+    Chunk *chunk = (Chunk *)calloc(1, sizeof(Chunk));
+    if (chunk == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (world_storage == STORAGE_OCTREE) {
+        octree_init(&chunk->octree, BLOCK_AIR);
+    } else if (world_storage == STORAGE_PALETTE) {
+        static const uint16_t air[CHUNK_VOLUME];
+        palette_from_blocks(&chunk->palette, air);
+    } else if ((chunk->blocks = (uint16_t *)calloc(CHUNK_VOLUME, sizeof(uint16_t))) == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->cx = cx;
+    chunk->cy = cy;
+    chunk->cz = cz;
+    add_chunk(chunk);
+    return chunk;
+}
+
+// Function to release a chunk and its mesh
+void free_chunk(Chunk *chunk) {
+    if (chunk->vao && opengl_initialized) {
+        glDeleteVertexArrays(1, &chunk->vao);
+        glDeleteBuffers(1, &chunk->vbo);
+    }
+    if (chunk->packed_map) release_world_map(chunk->packed_map);
+    chunk_drop_stored(chunk);
+    if (chunk->cached) palette_cache_unlink(chunk);
+    free(chunk->blocks);
+    octree_free(&chunk->octree);
+    palette_free(&chunk->palette);
+    free(chunk);
+}
+
+// Function to drop a chunk from the world, keeping the chunk array dense
+void destroy_chunk(Chunk *chunk) {
+    uint64_t key = pack_coords(chunk->cx, chunk->cy, chunk->cz);
+    uint32_t index = coord_map_find(&chunk_index, key);
+    coord_map_remove(&chunk_index, key);
+    chunk_count--;
+    if (index != chunk_count) {
+        Chunk *last = chunks[chunk_count];
+        chunks[index] = last;
+        coord_map_insert(&chunk_index, pack_coords(last->cx, last->cy, last->cz), index);
+    }
+    free_chunk(chunk);
+}
+
+// Function to read the block at a world position (BLOCK_AIR where no chunk exists)
+uint16_t world_get_block(int32_t x, int32_t y, int32_t z) {
+    Chunk *chunk = resident_chunk(x >> CHUNK_SHIFT, y >> CHUNK_SHIFT, z >> CHUNK_SHIFT);
+    return chunk ? chunk_get(chunk, chunk_block_index(x, y, z)) : BLOCK_AIR;
+}
+
+// Function to write the block at a world position and return the block that was there
+uint16_t world_set_block(int32_t x, int32_t y, int32_t z, uint16_t id) {
+    int32_t cx = x >> CHUNK_SHIFT, cy = y >> CHUNK_SHIFT, cz = z >> CHUNK_SHIFT;
+    Chunk *chunk = resident_chunk(cx, cy, cz);
+    if (chunk == NULL) {
+        if (id == BLOCK_AIR) return BLOCK_AIR;
+        chunk = create_chunk(cx, cy, cz);
+    }
+    int index = chunk_block_index(x, y, z);
+    uint16_t old = chunk_get(chunk, index);
+    if (old == id) return old;
+    chunk_set(chunk, index, id);
+    // Region edits compact each chunk once done; single edits once freed groups are over half the nodes
+    if (chunk->octree.free_nodes * 2 > chunk->octree.count) octree_compact(&chunk->octree);
+    instances_dirty = 1;
+
+    // A block on the chunk border changes which faces the neighbouring chunk shows
+    int32_t l[3] = { x & CHUNK_MASK, y & CHUNK_MASK, z & CHUNK_MASK };
+    for (int axis = 0; axis < 3; axis++) {
+        int step = l[axis] == 0 ? -1 : l[axis] == CHUNK_MASK ? 1 : 0;
+        if (step == 0) continue;
+        Chunk *neighbour = find_chunk(cx + (axis == 0) * step, cy + (axis == 1) * step, cz + (axis == 2) * step);
+        if (neighbour) chunk_mark_dirty(neighbour);
+    }
+
+    // Empty chunks are not kept around
+    if (chunk->block_count == 0) destroy_chunk(chunk);
+    stream_hold_cap(NULL);
+    return old;
+}
+
+// Function to append floats to a mesh buffer
+void mesh_append(MeshBuffer *mesh, const float *values, size_t count) {
+    if (mesh->count + count > mesh->capacity) {
+        size_t new_capacity = mesh->capacity ? mesh->capacity * 2 : 4096;
+        while (new_capacity < mesh->count + count) new_capacity *= 2;
+        float *new_data = (float *)realloc(mesh->data, new_capacity * sizeof(float));
+        if (new_data == NULL) {
+            fprintf(stderr, "Memory allocation failed for mesh.\n");
+            exit(EXIT_FAILURE);
+        }
+        mesh->data = new_data;
+        mesh->capacity = new_capacity;
+    }
+    memcpy(mesh->data + mesh->count, values, count * sizeof(float));
+    mesh->count += count;
+}
+
+// Function to locate a cell of a padded snapshot; coordinates run from -1 to CHUNK_SIZE
+int padded_index(int x, int y, int z) {
+    return (x + 1) + (z + 1) * PADDED_SIZE + (y + 1) * PADDED_SIZE * PADDED_SIZE;
+}
+
+// Function to copy a chunk and the border blocks of its 26 neighbours into a padded snapshot
+void chunk_snapshot(const Chunk *chunk, uint16_t *padded) {
+    Chunk *around[27];
+    for (int i = 0; i < 27; i++) {
+        around[i] = find_chunk(chunk->cx + i % 3 - 1, chunk->cy + i / 9 - 1, chunk->cz + i / 3 % 3 - 1);
+    }
+    for (int y = -1; y <= CHUNK_SIZE; y++) {
+        int ny = y < 0 ? 0 : y < CHUNK_SIZE ? 1 : 2;
+        for (int z = -1; z <= CHUNK_SIZE; z++) {
+            int nz = z < 0 ? 0 : z < CHUNK_SIZE ? 1 : 2;
+            for (int x = -1; x <= CHUNK_SIZE; x++) {
+                int nx = x < 0 ? 0 : x < CHUNK_SIZE ? 1 : 2;
+                Chunk *source = around[nx + nz * 3 + ny * 9];
+                padded[padded_index(x, y, z)] = source ? chunk_get(source, chunk_block_index(x, y, z)) : BLOCK_AIR;
+            }
+        }
+    }
+}
+
+// Function to emit one quad as two triangles, wound counter-clockwise seen from its normal.
+// Each vertex is x, y, z and the block type.
+void mesh_emit_quad(MeshBuffer *mesh, const float corners[4][3], int flip, uint16_t type) {
+    static const int order[2][6] = { {0, 1, 2, 0, 2, 3}, {0, 2, 1, 0, 3, 2} };
+    for (int i = 0; i < 6; i++) {
+        const float *corner = corners[order[flip][i]];
+        float vertex[4] = { corner[0], corner[1], corner[2], (float)type };
+        mesh_append(mesh, vertex, 4);
+    }
+}
+
+// Function to build a mesh from a padded snapshot (greedy meshing of the faces that touch air)
+// Reads nothing but its arguments, so it can run away from the chunk store.
+void mesh_snapshot(const uint16_t *padded, int32_t origin_x, int32_t origin_y, int32_t origin_z, MeshBuffer *mesh) {
+    const float origin[3] = { (float)origin_x, (float)origin_y, (float)origin_z };
+    uint16_t mask[CHUNK_SIZE * CHUNK_SIZE];
+    mesh->count = 0;
+
+    // Sweep each axis in both directions; u and v span the slice with u x v pointing along the axis
+    for (int axis = 0; axis < 3; axis++) {
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        for (int side = 0; side < 2; side++) {
+            int step = side ? 1 : -1;
+            for (int d = 0; d < CHUNK_SIZE; d++) {
+                // Collect the visible faces of this slice
+                for (int j = 0; j < CHUNK_SIZE; j++) {
+                    for (int i = 0; i < CHUNK_SIZE; i++) {
+                        int p[3];
+                        p[axis] = d; p[u] = i; p[v] = j;
+                        uint16_t block = padded[padded_index(p[0], p[1], p[2])];
+                        p[axis] += step;
+                        uint16_t next = padded[padded_index(p[0], p[1], p[2])];
+                        mask[i + j * CHUNK_SIZE] = (block != BLOCK_AIR && next == BLOCK_AIR) ? block : BLOCK_AIR;
+                    }
+                }
+
+                // Merge runs of the same block type into rectangles
+                for (int j = 0; j < CHUNK_SIZE; j++) {
+                    for (int i = 0; i < CHUNK_SIZE; ) {
+                        uint16_t type = mask[i + j * CHUNK_SIZE];
+                        if (type == BLOCK_AIR) { i++; continue; }
+                        int w = 1, h = 1;
+                        while (i + w < CHUNK_SIZE && mask[i + w + j * CHUNK_SIZE] == type) w++;
+                        for (; j + h < CHUNK_SIZE; h++) {
+                            int k = 0;
+                            while (k < w && mask[i + k + (j + h) * CHUNK_SIZE] == type) k++;
+                            if (k < w) break;
+                        }
+                        for (int y = 0; y < h; y++) {
+                            memset(&mask[i + (j + y) * CHUNK_SIZE], 0, w * sizeof(uint16_t));
+                        }
+
+                        // Blocks are unit cubes centred on their grid position
+                        float plane = d + 0.5f * step, u0 = i - 0.5f, v0 = j - 0.5f;
+                        float corners[4][3];
+                        for (int c = 0; c < 4; c++) {
+                            corners[c][axis] = origin[axis] + plane;
+                            corners[c][u] = origin[u] + u0 + ((c == 1 || c == 2) ? w : 0);
+                            corners[c][v] = origin[v] + v0 + ((c >= 2) ? h : 0);
+                        }
+                        mesh_emit_quad(mesh, (const float (*)[3])corners, !side, type);
+                        i += w;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Function to upload a built mesh to a chunk's own VBO
+void chunk_upload_mesh(Chunk *chunk, const MeshBuffer *mesh) {
+    if (chunk->vao == 0) {
+        glGenVertexArrays(1, &chunk->vao);
+        glGenBuffers(1, &chunk->vbo);
+        glBindVertexArray(chunk->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, chunk->vbo);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, chunk->vbo);
+    glBufferData(GL_ARRAY_BUFFER, mesh->count * sizeof(float), mesh->data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    chunk->vertex_count = (uint32_t)(mesh->count / 4);
+}
+
+// Function to rebuild a chunk's mesh from its blocks on the calling thread and upload it
+void chunk_build_mesh(Chunk *chunk) {
+    static uint16_t padded[PADDED_VOLUME];
+    chunk_snapshot(chunk, padded);
+    mesh_snapshot(padded, chunk->cx * CHUNK_SIZE, chunk->cy * CHUNK_SIZE, chunk->cz * CHUNK_SIZE, &mesh_scratch);
+    chunk_upload_mesh(chunk, &mesh_scratch);
+    chunk->mesh_generation = ++mesh_generation_counter;
+    chunk->dirty = 0;
+}
+
+// Function to add a job at the bottom (newest end) of a deque
+void deque_push(JobDeque *deque, MeshJob *job) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        size_t new_capacity = deque->capacity ? deque->capacity * 2 : 64;
+        MeshJob **new_jobs = (MeshJob **)malloc(new_capacity * sizeof(MeshJob *));
+        if (new_jobs == NULL) {
+            fprintf(stderr, "Memory allocation failed for job queue.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < deque->count; i++) {
+            new_jobs[i] = deque->jobs[(deque->top + i) % deque->capacity];
+        }
+        free(deque->jobs);
+        deque->jobs = new_jobs;
+        deque->capacity = new_capacity;
+        deque->top = 0;
+    }
+    deque->jobs[(deque->top + deque->count) % deque->capacity] = job;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Function to take the newest job from a deque (the owning worker's end)
+MeshJob* deque_pop(JobDeque *deque) {
+    MeshJob *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        job = deque->jobs[(deque->top + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Function to take the oldest job from another worker's deque
+MeshJob* deque_steal(JobDeque *deque) {
+    MeshJob *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        job = deque->jobs[deque->top];
+        deque->top = (deque->top + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Function run by each meshing worker: claim a job, find it in its own deque or steal it, mesh it
+void* mesh_worker_main(void *arg) {
+    size_t self = (size_t)arg;
+    size_t workers = (size_t)mesh_thread_count;
+    for (;;) {
+        // Claiming first guarantees a job is sitting in one of the deques
+        pthread_mutex_lock(&job_lock);
+        while (jobs_unclaimed == 0 && !jobs_shutdown) {
+            pthread_cond_wait(&job_ready, &job_lock);
+        }
+        if (jobs_shutdown) {
+            pthread_mutex_unlock(&job_lock);
+            return NULL;
+        }
+        jobs_unclaimed--;
+        pthread_mutex_unlock(&job_lock);
+
+        MeshJob *job = deque_pop(&mesh_deques[self]);
+        for (size_t i = 1; job == NULL; i++) {
+            job = deque_steal(&mesh_deques[(self + i) % workers]);
+        }
+
+        mesh_snapshot(job->padded, job->origin[0], job->origin[1], job->origin[2], &job->mesh);
+
+        pthread_mutex_lock(&jobs_done_lock);
+        job->next = jobs_done;
+        jobs_done = job;
+        pthread_mutex_unlock(&jobs_done_lock);
+    }
+}
+
+// Function to start the meshing workers the first time they are needed
+void start_mesh_workers(void) {
+    if (mesh_thread_count < 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        mesh_thread_count = cores > 2 ? (int)cores - 1 : 1; // Leave a core to the GL thread
+    }
+    mesh_workers = (pthread_t *)calloc((size_t)mesh_thread_count, sizeof(pthread_t));
+    mesh_deques = (JobDeque *)calloc((size_t)mesh_thread_count, sizeof(JobDeque));
+    if (mesh_workers == NULL || mesh_deques == NULL) {
+        fprintf(stderr, "Memory allocation failed for mesh workers.\n");
+        exit(EXIT_FAILURE);
+    }
+    jobs_shutdown = 0;
+    for (int i = 0; i < mesh_thread_count; i++) {
+        pthread_mutex_init(&mesh_deques[i].lock, NULL);
+    }
+    for (int i = 0; i < mesh_thread_count; i++) {
+        if (pthread_create(&mesh_workers[i], NULL, mesh_worker_main, (void *)(size_t)i) != 0) {
+            fprintf(stderr, "Failed to start mesh worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    mesh_workers_started = 1;
+    if (verbose) output_printf("Started %d mesh worker thread(s).\n", mesh_thread_count);
+}
+
+// Function to free a list of jobs linked through 'next'
+void free_job_list(MeshJob *job) {
+    while (job) {
+        MeshJob *next = job->next;
+        free(job->mesh.data);
+        free(job);
+        job = next;
+    }
+}
+
+// Function to stop the meshing workers and drop every job they still hold
+void stop_mesh_workers(void) {
+    if (mesh_workers_started) {
+        pthread_mutex_lock(&job_lock);
+        jobs_shutdown = 1;
+        pthread_cond_broadcast(&job_ready);
+        pthread_mutex_unlock(&job_lock);
+        for (int i = 0; i < mesh_thread_count; i++) {
+            pthread_join(mesh_workers[i], NULL);
+        }
+        for (int i = 0; i < mesh_thread_count; i++) {
+            MeshJob *job;
+            while ((job = deque_pop(&mesh_deques[i])) != NULL) {
+                job->next = jobs_free;
+                jobs_free = job;
+            }
+            free(mesh_deques[i].jobs);
+            pthread_mutex_destroy(&mesh_deques[i].lock);
+        }
+        free(mesh_workers);
+        free(mesh_deques);
+        mesh_workers = NULL;
+        mesh_deques = NULL;
+        mesh_workers_started = 0;
+        jobs_unclaimed = 0;
+    }
+    free_job_list(jobs_done);
+    free_job_list(jobs_ready);
+    free_job_list(jobs_free);
+    jobs_done = jobs_ready = jobs_free = NULL;
+    jobs_in_flight = 0;
+}
+
+// Function to snapshot a chunk into a job and hand it to the workers
+void submit_mesh_job(Chunk *chunk) {
+    if (!mesh_workers_started) start_mesh_workers();
+
+    MeshJob *job = jobs_free;
+    if (job) {
+        jobs_free = job->next;
+    } else if ((job = (MeshJob *)calloc(1, sizeof(MeshJob))) == NULL) {
+        fprintf(stderr, "Memory allocation failed for mesh job.\n");
+        exit(EXIT_FAILURE);
+    }
+    job->key = pack_coords(chunk->cx, chunk->cy, chunk->cz);
+    job->generation = ++mesh_generation_counter;
+    job->origin[0] = chunk->cx * CHUNK_SIZE;
+    job->origin[1] = chunk->cy * CHUNK_SIZE;
+    job->origin[2] = chunk->cz * CHUNK_SIZE;
+    chunk_snapshot(chunk, job->padded);
+    chunk->dirty = 0; // Later edits queue the chunk again
+    jobs_in_flight++;
+
+    deque_push(&mesh_deques[mesh_next_deque], job);
+    mesh_next_deque = (mesh_next_deque + 1) % (size_t)mesh_thread_count;
+
+    pthread_mutex_lock(&job_lock);
+    jobs_unclaimed++;
+    pthread_cond_signal(&job_ready);
+    pthread_mutex_unlock(&job_lock);
+}
+
+// Function to upload finished meshes within the budget. A result is dropped when its chunk
+// is gone or already shows a newer snapshot.
+void upload_finished_meshes(void) {
+    pthread_mutex_lock(&jobs_done_lock);
+    MeshJob *done = jobs_done;
+    jobs_done = NULL;
+    pthread_mutex_unlock(&jobs_done_lock);
+    while (done) {
+        MeshJob *next = done->next;
+        done->next = jobs_ready;
+        jobs_ready = done;
+        done = next;
+    }
+
+    while (jobs_ready && (remesh_budget == 0 || chunks_remeshed < remesh_budget)) {
+        MeshJob *job = jobs_ready;
+        jobs_ready = job->next;
+        jobs_in_flight--;
+
+        uint32_t index = coord_map_find(&chunk_index, job->key);
+        if (index != COORD_NOT_FOUND && chunks[index]->mesh_generation < job->generation) {
+            chunk_upload_mesh(chunks[index], &job->mesh);
+            chunks[index]->mesh_generation = job->generation;
+            chunks_remeshed++;
+        }
+        job->next = jobs_free;
+        jobs_free = job;
+    }
+}
+
+// Function to snap a script coordinate to the block grid (round half away from zero)
+int voxel_coord(float v, int32_t *out) {
+    if (!(v > -(float)COORD_LIMIT && v < (float)COORD_LIMIT - 1)) return 0; // Also rejects NaN
+    *out = (int32_t)(v < 0 ? v - 0.5f : v + 0.5f);
+    return 1;
+}
+
+// Function to add a block
+void neko_add_block(float x, float y, float z, uint16_t type) {
+    int32_t ix, iy, iz;
+    if (!voxel_coord(x, &ix) || !voxel_coord(y, &iy) || !voxel_coord(z, &iz)) {
+        fprintf(stderr, "Block position (%.1f, %.1f, %.1f) is out of range.\n", x, y, z);
+        return;
+    }
+
+    // Check if the block already exists
+    if (world_get_block(ix, iy, iz) != BLOCK_AIR) {
+        output_printf("Block already present at (%.1f, %.1f, %.1f).\n", x, y, z);
+        return;
+    }
+
+    // Add a new block
+    world_set_block(ix, iy, iz, type);
+    if (verbose) output_printf("Block added at (%.1f, %.1f, %.1f).\n", x, y, z);
+}
+
+// Function to remove a block
+void neko_remove_block(float x, float y, float z) {
+    int32_t ix, iy, iz;
+    if (!voxel_coord(x, &ix) || !voxel_coord(y, &iy) || !voxel_coord(z, &iz) ||
+        world_set_block(ix, iy, iz, BLOCK_AIR) == BLOCK_AIR) {
+        output_printf("No block found at (%.1f, %.1f, %.1f).\n", x, y, z);
+        return;
+    }
+    if (verbose) output_printf("Block removed at (%.1f, %.1f, %.1f).\n", x, y, z);
+}
+
+// Function to apply a region edit to one chunk; returns the number of blocks changed
+size_t chunk_edit_region(Chunk *chunk, const int32_t lo[3], const int32_t hi[3], RegionOp op,
+                         uint16_t from, uint16_t to) {
+    int32_t base[3] = { chunk->cx * CHUNK_SIZE, chunk->cy * CHUNK_SIZE, chunk->cz * CHUNK_SIZE };
+    int32_t first[3], last[3];
+    for (int axis = 0; axis < 3; axis++) {
+        first[axis] = lo[axis] > base[axis] ? lo[axis] : base[axis];
+        last[axis] = hi[axis] < base[axis] + CHUNK_MASK ? hi[axis] : base[axis] + CHUNK_MASK;
+        if (first[axis] > last[axis]) return 0;
+    }
+
+    size_t changed = 0;
+    for (int32_t y = first[1]; y <= last[1]; y++) {
+        for (int32_t z = first[2]; z <= last[2]; z++) {
+            int on_side = y == lo[1] || y == hi[1] || z == lo[2] || z == hi[2];
+            for (int32_t x = first[0]; x <= last[0]; x++) {
+                int index = chunk_block_index(x, y, z);
+                uint16_t old = chunk_get(chunk, index);
+                uint16_t id = old;
+                switch (op) {
+                    case REGION_FILL:    id = to; break;
+                    case REGION_HOLLOW:  if (on_side || x == lo[0] || x == hi[0]) id = to; break;
+                    case REGION_REPLACE: if (old == from) id = to; break;
+                    case REGION_CLEAR:   id = BLOCK_AIR; break;
+                }
+                if (id != old) {
+                    chunk_set(chunk, index, id);
+                    changed++;
+                }
+            }
+        }
+    }
+    // Nodes the octree grew to partway through the edit are given back
+    if (changed && chunk->octree.nodes) octree_compact(&chunk->octree);
+    return changed;
+}
+
+// Function to tell whether a region edit can turn air into blocks (and so needs chunks that do not exist yet)
+int region_fills_air(RegionOp op, uint16_t from, uint16_t to) {
+    if (to == BLOCK_AIR) return 0;
+    return op == REGION_FILL || op == REGION_HOLLOW || (op == REGION_REPLACE && from == BLOCK_AIR);
+}
+
+// Function to apply a region edit to the box lo..hi (inclusive), one chunk at a time;
+// returns the number of blocks changed
+size_t world_edit_region(const int32_t lo[3], const int32_t hi[3], RegionOp op, uint16_t from, uint16_t to) {
+    int32_t clo[3], chi[3];
+    uint64_t span = 1;
+    for (int axis = 0; axis < 3; axis++) {
+        clo[axis] = lo[axis] >> CHUNK_SHIFT;
+        chi[axis] = hi[axis] >> CHUNK_SHIFT;
+        span *= (uint64_t)(chi[axis] - clo[axis] + 1);
+    }
+    size_t changed = 0;
+    int creates = region_fills_air(op, from, to);
+    if (!creates && span > chunk_count + stored_count) {
+        // Sparse world and a large box: visit the chunks that exist instead of every position.
+        // Going backwards keeps the walk valid when destroy_chunk() moves the last chunk down.
+        for (size_t i = chunk_count; i-- > 0; ) {
+            Chunk *chunk = chunks[i];
+            if (chunk->cx < clo[0] || chunk->cx > chi[0] || chunk->cy < clo[1] || chunk->cy > chi[1] ||
+                chunk->cz < clo[2] || chunk->cz > chi[2]) {
+                continue;
+            }
+            changed += chunk_edit_region(chunk, lo, hi, op, from, to);
+            if (chunk->block_count == 0) destroy_chunk(chunk);
+        }
+        // Then the streamed-out ones, one at a time: bringing one back may evict chunks edited above,
+        // which are stored after the ones still to visit
+        for (size_t i = stored_count; i-- > 0; ) {
+            const StoredChunk *entry = &stored_chunks[i];
+            if (entry->cx < clo[0] || entry->cx > chi[0] || entry->cy < clo[1] || entry->cy > chi[1] ||
+                entry->cz < clo[2] || entry->cz > chi[2]) {
+                continue;
+            }
+            Chunk *chunk = stream_in_now((uint32_t)i);
+            if (chunk == NULL) continue;
+            changed += chunk_edit_region(chunk, lo, hi, op, from, to);
+            if (chunk->block_count == 0) destroy_chunk(chunk);
+        }
+    } else {
+        for (int32_t cy = clo[1]; cy <= chi[1]; cy++) {
+            for (int32_t cz = clo[2]; cz <= chi[2]; cz++) {
+                for (int32_t cx = clo[0]; cx <= chi[0]; cx++) {
+                    // Streamed-out chunks are brought back, which may evict chunks already edited
+                    Chunk *chunk = resident_chunk(cx, cy, cz);
+                    if (chunk == NULL) {
+                        if (!creates) continue;
+                        chunk = create_chunk(cx, cy, cz);
+                    }
+                    changed += chunk_edit_region(chunk, lo, hi, op, from, to);
+                    if (chunk->block_count == 0) destroy_chunk(chunk);
+                }
+            }
+        }
+    }
+    stream_hold_cap(NULL);
+    if (changed == 0) return 0;
+    instances_dirty = 1;
+
+    // Remesh every chunk the box touches, plus those just outside it that show faces of its border
+    int32_t elo[3], ehi[3];
+    span = 1;
+    for (int axis = 0; axis < 3; axis++) {
+        elo[axis] = (lo[axis] - 1) >> CHUNK_SHIFT;
+        ehi[axis] = (hi[axis] + 1) >> CHUNK_SHIFT;
+        span *= (uint64_t)(ehi[axis] - elo[axis] + 1);
+    }
+    if (span > chunk_count) {
+        for (size_t i = 0; i < chunk_count; i++) {
+            Chunk *chunk = chunks[i];
+            if (chunk->cx >= elo[0] && chunk->cx <= ehi[0] && chunk->cy >= elo[1] && chunk->cy <= ehi[1] &&
+                chunk->cz >= elo[2] && chunk->cz <= ehi[2]) {
+                chunk_mark_dirty(chunk);
+            }
+        }
+    } else {
+        for (int32_t cy = elo[1]; cy <= ehi[1]; cy++) {
+            for (int32_t cz = elo[2]; cz <= ehi[2]; cz++) {
+                for (int32_t cx = elo[0]; cx <= ehi[0]; cx++) {
+                    Chunk *chunk = find_chunk(cx, cy, cz);
+                    if (chunk) chunk_mark_dirty(chunk);
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+// Function to run a region command between two corners given in script coordinates
+void neko_region(RegionOp op, const float corners[6], uint16_t from, uint16_t to) {
+    int32_t a[3], b[3], lo[3], hi[3];
+    for (int axis = 0; axis < 3; axis++) {
+        if (!voxel_coord(corners[axis], &a[axis]) || !voxel_coord(corners[axis + 3], &b[axis])) {
+            fprintf(stderr, "Region (%.1f, %.1f, %.1f) to (%.1f, %.1f, %.1f) is out of range.\n",
+                    corners[0], corners[1], corners[2], corners[3], corners[4], corners[5]);
+            return;
+        }
+        lo[axis] = a[axis] < b[axis] ? a[axis] : b[axis];
+        hi[axis] = a[axis] < b[axis] ? b[axis] : a[axis];
+    }
+    uint64_t volume = (uint64_t)(hi[0] - lo[0] + 1) * (uint64_t)(hi[1] - lo[1] + 1) * (uint64_t)(hi[2] - lo[2] + 1);
+    if (region_fills_air(op, from, to) && volume > REGION_MAX_BLOCKS) {
+        fprintf(stderr, "Region too large for '%s' (%llu blocks, at most %llu).\n",
+                region_names[op], (unsigned long long)volume, (unsigned long long)REGION_MAX_BLOCKS);
+        return;
+    }
+
+    size_t changed = world_edit_region(lo, hi, op, from, to);
+    if (verbose) {
+        output_printf("Region %s (%.1f, %.1f, %.1f) to (%.1f, %.1f, %.1f): %zu blocks changed.\n", region_names[op],
+                      corners[0], corners[1], corners[2], corners[3], corners[4], corners[5], changed);
+    }
+}
+
+// Function to drop every chunk, resident or stored, along with the remesh queue that refers to them
+void clear_world(void) {
+    for (size_t i = 0; i < chunk_count; i++) {
+        free_chunk(chunks[i]);
+    }
+    free(chunks);
+    chunks = NULL;
+    chunk_count = chunk_capacity = 0;
+    coord_map_free(&chunk_index);
+    free(remesh_queue);
+    remesh_queue = NULL;
+    remesh_head = remesh_count = remesh_capacity = 0;
+    clear_stored_chunks();
+    instances_dirty = 1;
+}
+
+// Function to unmap a world file once no chunk reads from it any more
+void release_world_map(WorldMap *map) {
+    if (map->references > 0 && --map->references > 0) return;
+    munmap(map->data, map->length);
+    free(map);
+}
+
+// Function to decode packed blocks (palette and runs) into a block array; returns 1 when the runs
+// add up to a whole chunk of valid ids with the expected block count. With no block array the
+// data is only checked. Safe to call from any thread.
+int unpack_blocks(const uint8_t *packed, size_t length, uint32_t expected_count, uint16_t *blocks) {
+    const uint16_t *words = (const uint16_t *)packed;
+    size_t word_count = length / sizeof(uint16_t);
+    if (word_count == 0) return 0;
+    size_t palette_count = words[0];
+    const uint16_t *palette = words + 1;
+    int ok = palette_count > 0 && palette_count < word_count && (word_count - 1 - palette_count) % 2 == 0;
+    for (size_t i = 0; ok && i < palette_count; i++) {
+        ok = palette[i] <= BLOCK_TYPE_MAX;
+    }
+
+    size_t filled = 0;
+    uint32_t block_count = 0;
+    for (const uint16_t *run = palette + palette_count; ok && run < words + word_count; run += 2) {
+        size_t run_length = run[0];
+        if (run_length == 0 || run_length > CHUNK_VOLUME - filled || run[1] >= palette_count) {
+            ok = 0;
+            break;
+        }
+        uint16_t id = palette[run[1]];
+        for (size_t i = 0; blocks && i < run_length; i++) {
+            blocks[filled + i] = id;
+        }
+        filled += run_length;
+        if (id != BLOCK_AIR) block_count += (uint32_t)run_length;
+    }
+    return ok && filled == CHUNK_VOLUME && block_count == expected_count;
+}
+
+// Function to decode a loaded chunk's blocks on first use (load_world() has checked the data)
+void chunk_unpack(Chunk *chunk) {
+    uint16_t *blocks = (uint16_t *)malloc(CHUNK_VOLUME * sizeof(uint16_t));
+    if (blocks == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!unpack_blocks(chunk->packed, chunk->packed_length, chunk->block_count, blocks)) {
+        fprintf(stderr, "Error: Saved chunk (%d, %d, %d) changed on disk while the world was loaded.\n",
+                chunk->cx, chunk->cy, chunk->cz);
+        exit(EXIT_FAILURE);
+    }
+
+    chunk->blocks = blocks;
+    release_world_map(chunk->packed_map);
+    chunk->packed_map = NULL;
+    chunk->packed = NULL;
+    chunk->packed_length = 0;
+    chunk_apply_storage(chunk);
+}
+
+// Function to pack a chunk's blocks as a palette and runs; returns the packed size in bytes.
+// A chunk that was never unpacked is copied as it was loaded.
+size_t chunk_pack(Chunk *chunk, uint16_t *out) {
+    static uint16_t blocks[CHUNK_VOLUME];
+    if (chunk->packed) {
+        memcpy(out, chunk->packed, chunk->packed_length);
+        return chunk->packed_length;
+    }
+    const uint16_t *source = chunk->blocks;
+    if (source == NULL) {
+        chunk_copy_blocks(chunk, blocks);
+        source = blocks;
+    }
+
+    int slot_of[BLOCK_TYPE_COUNT];
+    for (int i = 0; i < BLOCK_TYPE_COUNT; i++) slot_of[i] = -1;
+    size_t palette_count = 0;
+    for (int index = 0; index < CHUNK_VOLUME; index++) {
+        uint16_t id = source[index];
+        if (slot_of[id] < 0) {
+            slot_of[id] = (int)palette_count;
+            out[1 + palette_count++] = id;
+        }
+    }
+    out[0] = (uint16_t)palette_count;
+
+    size_t count = 1 + palette_count;
+    for (int index = 0; index < CHUNK_VOLUME;) {
+        uint16_t id = source[index];
+        int start = index;
+        while (index < CHUNK_VOLUME && source[index] == id) index++;
+        out[count++] = (uint16_t)(index - start);
+        out[count++] = (uint16_t)slot_of[id];
+    }
+    return count * sizeof(uint16_t);
+}
+
+// Function to write every chunk to a world file; returns the file size, or 0 on failure.
+// The file is written beside the target and renamed over it, so a failed save keeps the old one.
+uint64_t save_world(const char *path) {
+    static uint16_t packed[WORLD_PACKED_MAX / sizeof(uint16_t)];
+    char temp_path[1100];
+    int temp_length = snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = temp_length < (int)sizeof(temp_path) ? fopen(temp_path, "wb") : NULL;
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to write world to %s\n", path);
+        return 0;
+    }
+
+    WorldChunkEntry *table = (WorldChunkEntry *)calloc(chunk_count + stored_count + 1, sizeof(WorldChunkEntry));
+    if (table == NULL) {
+        fprintf(stderr, "Memory allocation failed for world table.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Packed chunks go after the table, which is written last once their offsets are known
+    size_t saved = stored_count;
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (chunks[i]->block_count > 0) saved++;
+    }
+    uint64_t offset = sizeof(WorldHeader) + saved * sizeof(WorldChunkEntry);
+    int ok = fseeko(file, (off_t)offset, SEEK_SET) == 0;
+    size_t entry = 0;
+    for (size_t i = 0; ok && i < chunk_count; i++) {
+        Chunk *chunk = chunks[i];
+        if (chunk->block_count == 0) continue;
+        size_t length = chunk_pack(chunk, packed);
+        WorldChunkEntry *e = &table[entry++];
+        e->cx = chunk->cx;
+        e->cy = chunk->cy;
+        e->cz = chunk->cz;
+        e->block_count = chunk->block_count;
+        e->offset = offset;
+        e->length = (uint32_t)length;
+        ok = fwrite(packed, 1, length, file) == length;
+        offset += length;
+    }
+
+    // Streamed-out chunks are copied as they are stored
+    for (size_t i = 0; ok && i < stored_count; i++) {
+        const StoredChunk *stored = &stored_chunks[i];
+        WorldChunkEntry *e = &table[entry++];
+        e->cx = stored->cx;
+        e->cy = stored->cy;
+        e->cz = stored->cz;
+        e->block_count = stored->block_count;
+        e->offset = offset;
+        e->length = stored->length;
+        ok = stream_read_packed(stored->map, stored->offset, stored->length, packed) &&
+             fwrite(packed, 1, stored->length, file) == stored->length;
+        offset += stored->length;
+    }
+
+    WorldHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WORLD_MAGIC, sizeof(header.magic));
+    header.version = WORLD_VERSION;
+    header.chunk_size = CHUNK_SIZE;
+    header.chunk_count = saved;
+    ok = ok && fseeko(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+         fwrite(table, sizeof(WorldChunkEntry), saved, file) == saved;
+    ok = fclose(file) == 0 && ok;
+    free(table);
+    if (!ok || rename(temp_path, path) != 0) {
+        fprintf(stderr, "Error: Unable to write world to %s\n", path);
+        remove(temp_path);
+        return 0;
+    }
+    return offset;
+}
+
+// Function to replace the world with the chunks of a world file; returns 0 on success.
+// The file is mapped and each chunk is only unpacked when its blocks are first used.
+int load_world(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Unable to open world %s\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(WorldHeader)) {
+        fprintf(stderr, "Error: %s is not a NekoLang world.\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t length = (size_t)st.st_size;
+    uint8_t *data = (uint8_t *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map world %s\n", path);
+        return -1;
+    }
+
+    // Check the header and every table entry before the current world is dropped
+    const WorldHeader *header = (const WorldHeader *)data;
+    const WorldChunkEntry *table = (const WorldChunkEntry *)(data + sizeof(WorldHeader));
+    const char *problem = NULL;
+    if (memcmp(header->magic, WORLD_MAGIC, sizeof(header->magic)) != 0) {
+        problem = "is not a NekoLang world";
+    } else if (header->version != WORLD_VERSION || header->chunk_size != CHUNK_SIZE) {
+        problem = "was saved by an incompatible version";
+    } else if (header->chunk_count > (length - sizeof(WorldHeader)) / sizeof(WorldChunkEntry)) {
+        problem = "is truncated";
+    }
+    int32_t chunk_limit = COORD_LIMIT >> CHUNK_SHIFT;
+    for (uint64_t i = 0; problem == NULL && i < header->chunk_count; i++) {
+        const WorldChunkEntry *e = &table[i];
+        if (e->offset % sizeof(uint16_t) != 0 || e->length < 2 * sizeof(uint16_t) || e->length > WORLD_PACKED_MAX ||
+            e->offset > length || e->length > length - e->offset ||
+            e->block_count == 0 || e->block_count > CHUNK_VOLUME ||
+            e->cx < -chunk_limit || e->cx >= chunk_limit || e->cy < -chunk_limit || e->cy >= chunk_limit ||
+            e->cz < -chunk_limit || e->cz >= chunk_limit) {
+            problem = "is corrupted";
+        }
+    }
+    if (problem) {
+        fprintf(stderr, "Error: World %s %s.\n", path, problem);
+        munmap(data, length);
+        return -1;
+    }
+
+    clear_world();
+    WorldMap *map = (WorldMap *)malloc(sizeof(WorldMap));
+    if (map == NULL) {
+        fprintf(stderr, "Memory allocation failed for world.\n");
+        exit(EXIT_FAILURE);
+    }
+    map->data = data;
+    map->length = length;
+    map->references = 0;
+    for (uint64_t i = 0; i < header->chunk_count; i++) {
+        const WorldChunkEntry *e = &table[i];
+        if (find_chunk(e->cx, e->cy, e->cz) ||
+            coord_map_find(&stored_index, pack_coords(e->cx, e->cy, e->cz)) != COORD_NOT_FOUND) {
+            fprintf(stderr, "Error: World %s repeats chunk (%d, %d, %d); the repeat is ignored.\n",
+                    path, e->cx, e->cy, e->cz);
+            continue;
+        }
+        if (!unpack_blocks(data + e->offset, e->length, e->block_count, NULL)) {
+            // Checking the runs is cheap next to decoding, and no empty chunk is left behind
+            fprintf(stderr, "Error: Saved chunk (%d, %d, %d) is corrupted; it is skipped.\n", e->cx, e->cy, e->cz);
+            continue;
+        }
+        if (world_stream_radius > 0 && !chunk_in_stream_range(e->cx, e->cy, e->cz)) {
+            // Far chunks are left in the file until the player comes near
+            add_stored_chunk(e->cx, e->cy, e->cz, e->block_count, map, e->offset, e->length);
+            continue;
+        }
+        Chunk *chunk = (Chunk *)calloc(1, sizeof(Chunk));
+        if (chunk == NULL) {
+            fprintf(stderr, "Memory allocation failed for chunk.\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->cx = e->cx;
+        chunk->cy = e->cy;
+        chunk->cz = e->cz;
+        chunk->block_count = e->block_count;
+        chunk->packed_map = map;
+        chunk->packed = data + e->offset;
+        chunk->packed_length = e->length;
+        chunk->stored_map = map;
+        chunk->stored_offset = e->offset;
+        chunk->stored_length = e->length;
+        map->references += 2;
+        add_chunk(chunk);
+        chunk_mark_dirty(chunk);
+    }
+    if (map->references == 0) release_world_map(map);
+    return 0;
+}
+
+// Function to save the world (command entry point)
+void neko_save_world(const char *path) {
+    double start = now_seconds();
+    uint64_t size = save_world(path);
+    if (size && verbose) {
+        output_printf("World saved to %s: %zu chunks, %llu bytes in %.1f ms.\n", path, chunk_count + stored_count,
+                      (unsigned long long)size, (now_seconds() - start) * 1000.0);
+    }
+}
+
+// Function to load a saved world in place of the current one (command entry point)
+void neko_load_world(const char *path) {
+    double start = now_seconds();
+    if (load_world(path) == 0 && verbose) {
+        output_printf("World loaded from %s: %zu chunks (%zu left on disk) in %.1f ms.\n", path,
+                      chunk_count + stored_count, stored_count, (now_seconds() - start) * 1000.0);
+    }
+}
+
+// Function to find the chunk the player is in
+void player_chunk(int32_t out[3]) {
+    const float position[3] = { player_x, player_y, player_z };
+    for (int axis = 0; axis < 3; axis++) {
+        float v = position[axis];
+        if (!(v > -(float)COORD_LIMIT)) v = -(float)COORD_LIMIT; // Also catches NaN
+        if (v > (float)(COORD_LIMIT - 1)) v = (float)(COORD_LIMIT - 1);
+        int32_t block = (int32_t)v;
+        if ((float)block > v) block--; // Round towards negative infinity
+        out[axis] = block >> CHUNK_SHIFT;
+    }
+}
+
+// Function to measure the squared distance, in chunks, between two chunk positions
+int64_t chunk_distance2(const int32_t a[3], int32_t cx, int32_t cy, int32_t cz) {
+    int64_t dx = (int64_t)cx - a[0], dy = (int64_t)cy - a[1], dz = (int64_t)cz - a[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Function to tell whether a chunk should be resident with streaming on
+int chunk_in_stream_range(int32_t cx, int32_t cy, int32_t cz) {
+    int32_t center[3];
+    player_chunk(center);
+    return chunk_distance2(center, cx, cy, cz) <= (int64_t)world_stream_radius * world_stream_radius;
+}
+
+// Function to estimate the memory a resident chunk holds: its blocks and its mesh
+size_t chunk_memory(const Chunk *chunk) {
+    return sizeof(Chunk) + (chunk->blocks ? CHUNK_VOLUME * sizeof(uint16_t) : 0) +
+           (size_t)chunk->octree.capacity * sizeof(uint32_t) + (size_t)chunk->palette.count * sizeof(uint16_t) +
+           (size_t)CHUNK_VOLUME * chunk->palette.bits / 8 + (size_t)chunk->vertex_count * 4 * sizeof(float);
+}
+
+// Function to record a non-resident chunk; a world map reference is taken for the entry
+void add_stored_chunk(int32_t cx, int32_t cy, int32_t cz, uint32_t block_count, WorldMap *map,
+                      uint64_t offset, uint32_t length) {
+    if (stored_count == stored_capacity) {
+        size_t new_capacity = stored_capacity ? stored_capacity * 2 : 64;
+        StoredChunk *new_stored = (StoredChunk *)realloc(stored_chunks, new_capacity * sizeof(StoredChunk));
+        if (new_stored == NULL) {
+            fprintf(stderr, "Memory allocation failed for stored chunk.\n");
+            exit(EXIT_FAILURE);
+        }
+        stored_chunks = new_stored;
+        stored_capacity = new_capacity;
+    }
+    StoredChunk *entry = &stored_chunks[stored_count];
+    entry->cx = cx;
+    entry->cy = cy;
+    entry->cz = cz;
+    entry->block_count = block_count;
+    entry->map = map;
+    entry->offset = offset;
+    entry->length = length;
+    entry->loading = 0;
+    if (map) map->references++;
+    coord_map_insert(&stored_index, pack_coords(cx, cy, cz), (uint32_t)stored_count);
+    stored_count++;
+}
+
+// Function to forget a stored chunk, keeping the array dense
+void remove_stored_chunk(uint32_t slot) {
+    StoredChunk *entry = &stored_chunks[slot];
+    if (entry->map) release_world_map(entry->map);
+    coord_map_remove(&stored_index, pack_coords(entry->cx, entry->cy, entry->cz));
+    stored_count--;
+    if (slot != stored_count) {
+        *entry = stored_chunks[stored_count];
+        coord_map_insert(&stored_index, pack_coords(entry->cx, entry->cy, entry->cz), slot);
+    }
+}
+
+// Function to read a stored chunk's packed blocks into a buffer of WORLD_PACKED_MAX bytes;
+// returns 1 on success. Safe to call from the I/O thread.
+int stream_read_packed(WorldMap *map, uint64_t offset, uint32_t length, uint16_t *out) {
+    if (map) {
+        memcpy(out, map->data + offset, length);
+        return 1;
+    }
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(spill_fd, (uint8_t *)out + done, length - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+// Function to read and decode the packed blocks of a request; returns the blocks or NULL on failure
+uint16_t* stream_read_blocks(WorldMap *map, uint64_t offset, uint32_t length, uint32_t block_count) {
+    uint16_t packed[WORLD_PACKED_MAX / sizeof(uint16_t)];
+    uint16_t *blocks = (uint16_t *)malloc(CHUNK_VOLUME * sizeof(uint16_t));
+    if (blocks == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!stream_read_packed(map, offset, length, packed) ||
+        !unpack_blocks((const uint8_t *)packed, length, block_count, blocks)) {
+        free(blocks);
+        return NULL;
+    }
+    return blocks;
+}
+
+// Function run by the I/O thread: read and decode queued chunks in order
+void* stream_io_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&stream_lock);
+    for (;;) {
+        while (stream_queue_head == NULL && !stream_shutdown) {
+            pthread_cond_wait(&stream_ready, &stream_lock);
+        }
+        if (stream_queue_head == NULL) break;
+        StreamRequest *request = stream_queue_head;
+        stream_queue_head = request->next;
+        if (stream_queue_head == NULL) stream_queue_tail = NULL;
+        pthread_mutex_unlock(&stream_lock);
+
+        request->blocks = stream_read_blocks(request->map, request->offset, request->length, request->block_count);
+
+        pthread_mutex_lock(&stream_lock);
+        request->next = stream_done;
+        stream_done = request;
+    }
+    pthread_mutex_unlock(&stream_lock);
+    return NULL;
+}
+
+// Function to release requests the GL thread will not pick up
+void free_stream_requests(StreamRequest *request) {
+    while (request) {
+        StreamRequest *next = request->next;
+        if (request->map) release_world_map(request->map);
+        free(request->blocks);
+        free(request);
+        request = next;
+    }
+}
+
+// Function to stop the I/O thread and drop the reads it had not handed back
+void stop_stream_thread(void) {
+    if (stream_thread_started) {
+        pthread_mutex_lock(&stream_lock);
+        stream_shutdown = 1;
+        pthread_cond_signal(&stream_ready);
+        pthread_mutex_unlock(&stream_lock);
+        pthread_join(stream_thread, NULL);
+        stream_thread_started = 0;
+        stream_shutdown = 0;
+    }
+    free_stream_requests(stream_queue_head);
+    free_stream_requests(stream_done);
+    stream_queue_head = stream_queue_tail = stream_done = NULL;
+    stream_in_flight = 0;
+    for (size_t i = 0; i < stored_count; i++) {
+        stored_chunks[i].loading = 0;
+    }
+}
+
+// Function to make a streamed-in chunk resident and queue it and its neighbours for remeshing.
+// A chunk that could not be read is reported and dropped; NULL is returned.
+Chunk* stream_in_chunk(uint32_t slot, uint16_t *blocks) {
+    const StoredChunk *entry = &stored_chunks[slot];
+    if (blocks == NULL) {
+        fprintf(stderr, "Error: Streamed chunk (%d, %d, %d) could not be read; it is dropped.\n",
+                entry->cx, entry->cy, entry->cz);
+        if (entry->map == NULL) spill_free(entry->offset, entry->length);
+        remove_stored_chunk(slot);
+        return NULL;
+    }
+    Chunk *chunk = (Chunk *)calloc(1, sizeof(Chunk));
+    if (chunk == NULL) {
+        fprintf(stderr, "Memory allocation failed for chunk.\n");
+        exit(EXIT_FAILURE);
+    }
+    chunk->cx = entry->cx;
+    chunk->cy = entry->cy;
+    chunk->cz = entry->cz;
+    chunk->blocks = blocks;
+    chunk->block_count = entry->block_count;
+    // The stored copy is kept (the spill space or a map reference moves to the chunk) until the blocks change
+    chunk->stored_map = entry->map;
+    chunk->stored_offset = entry->offset;
+    chunk->stored_length = entry->length;
+    if (entry->map) entry->map->references++;
+    chunk_apply_storage(chunk);
+    remove_stored_chunk(slot);
+    add_chunk(chunk);
+    chunk_mark_dirty(chunk);
+    instances_dirty = 1;
+
+    // Neighbours meshed while this chunk was away show faces towards it
+    for (int i = 0; i < 6; i++) {
+        int axis = i / 2, step = i % 2 ? 1 : -1;
+        Chunk *neighbour = find_chunk(chunk->cx + (axis == 0) * step, chunk->cy + (axis == 1) * step,
+                                      chunk->cz + (axis == 2) * step);
+        if (neighbour) chunk_mark_dirty(neighbour);
+    }
+    return chunk;
+}
+
+// Function to bring a stored chunk back right away, for edits and reads that cannot wait
+Chunk* stream_in_now(uint32_t slot) {
+    const StoredChunk *entry = &stored_chunks[slot];
+    uint16_t *blocks = stream_read_blocks(entry->map, entry->offset, entry->length, entry->block_count);
+    stream_sync_loads++;
+    return stream_in_chunk(slot, blocks); // A read still in flight for it is dropped on pickup
+}
+
+// Function to find a chunk, bringing it back first if it was streamed out
+Chunk* resident_chunk(int32_t cx, int32_t cy, int32_t cz) {
+    Chunk *chunk = find_chunk(cx, cy, cz);
+    if (chunk || stored_count == 0) return chunk;
+    uint32_t slot = coord_map_find(&stored_index, pack_coords(cx, cy, cz));
+    return slot == COORD_NOT_FOUND ? NULL : stream_in_now(slot);
+}
+
+// Function to bring back every streamed-out chunk in a box of chunk coordinates
+void stream_in_range(const int32_t lo[3], const int32_t hi[3]) {
+    if (stored_count == 0) return;
+    uint64_t span = 1;
+    for (int axis = 0; axis < 3; axis++) span *= (uint64_t)(hi[axis] - lo[axis] + 1);
+    if (span > stored_count) {
+        // Going backwards keeps the walk valid when remove_stored_chunk() moves the last entry down
+        for (size_t i = stored_count; i-- > 0; ) {
+            const StoredChunk *entry = &stored_chunks[i];
+            if (entry->cx >= lo[0] && entry->cx <= hi[0] && entry->cy >= lo[1] && entry->cy <= hi[1] &&
+                entry->cz >= lo[2] && entry->cz <= hi[2]) {
+                stream_in_now((uint32_t)i);
+            }
+        }
+    } else {
+        for (int32_t cy = lo[1]; cy <= hi[1]; cy++) {
+            for (int32_t cz = lo[2]; cz <= hi[2]; cz++) {
+                for (int32_t cx = lo[0]; cx <= hi[0]; cx++) {
+                    resident_chunk(cx, cy, cz);
+                }
+            }
+        }
+    }
+}
+
+// Function to pick the size size_class of spill space for a packed length
+int spill_class(uint32_t length) {
+    int size_class = 0;
+    while (((uint32_t)1 << (SPILL_CLASS_MIN + size_class)) < length) size_class++;
+    return size_class;
+}
+
+// Function to take spill space for a packed length, reusing freed space of the same size first
+uint64_t spill_alloc(uint32_t length) {
+    int size_class = spill_class(length);
+    SpillFreeList *list = &spill_free_lists[size_class];
+    if (list->count > 0) return list->offsets[--list->count];
+    uint64_t offset = spill_end;
+    spill_end += (uint64_t)1 << (SPILL_CLASS_MIN + size_class);
+    return offset;
+}
+
+// Function to give spill space back for reuse
+void spill_free(uint64_t offset, uint32_t length) {
+    SpillFreeList *list = &spill_free_lists[spill_class(length)];
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+        uint64_t *new_offsets = (uint64_t *)realloc(list->offsets, new_capacity * sizeof(uint64_t));
+        if (new_offsets == NULL) {
+            fprintf(stderr, "Memory allocation failed for spill file.\n");
+            exit(EXIT_FAILURE);
+        }
+        list->offsets = new_offsets;
+        list->capacity = new_capacity;
+    }
+    list->offsets[list->count++] = offset;
+}
+
+// Function to forget a chunk's stored copy once its blocks change, freeing its spill space
+void chunk_drop_stored(Chunk *chunk) {
+    if (chunk->stored_length == 0) return;
+    if (chunk->stored_map) release_world_map(chunk->stored_map);
+    else spill_free(chunk->stored_offset, chunk->stored_length);
+    chunk->stored_map = NULL;
+    chunk->stored_length = 0;
+}
+
+// Function to write a resident chunk out and drop it; returns 0 if the spill file cannot be written.
+// A chunk whose blocks did not change since it was loaded or streamed in points back at its copy.
+int evict_chunk(Chunk *chunk) {
+    static uint16_t packed[WORLD_PACKED_MAX / sizeof(uint16_t)];
+    if (chunk->block_count == 0) {
+        destroy_chunk(chunk);
+        return 1;
+    }
+    if (chunk->stored_length) {
+        add_stored_chunk(chunk->cx, chunk->cy, chunk->cz, chunk->block_count, chunk->stored_map,
+                         chunk->stored_offset, chunk->stored_length);
+        if (chunk->stored_map) release_world_map(chunk->stored_map); // The entry holds its own reference
+        chunk->stored_map = NULL;
+        chunk->stored_length = 0;
+    } else {
+        if (spill_fd < 0) {
+            const char *dir = getenv("TMPDIR");
+            char path[1100];
+            snprintf(path, sizeof(path), "%s/neko-spill-XXXXXX", dir && dir[0] ? dir : "/tmp");
+            spill_fd = mkstemp(path);
+            if (spill_fd < 0) {
+                fprintf(stderr, "Error: Unable to create a spill file in %s; chunks stay resident.\n",
+                        dir && dir[0] ? dir : "/tmp");
+                world_stream_radius = 0;
+                return 0;
+            }
+            unlink(path); // Goes away with the process
+        }
+        size_t length = chunk_pack(chunk, packed), done = 0;
+        uint64_t offset = spill_alloc((uint32_t)length);
+        while (done < length) {
+            ssize_t n = pwrite(spill_fd, (uint8_t *)packed + done, length - done, (off_t)(offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fprintf(stderr, "Error: Unable to write the spill file; chunks stay resident.\n");
+                spill_free(offset, (uint32_t)length);
+                world_stream_radius = 0;
+                return 0;
+            }
+            done += (size_t)n;
+        }
+        add_stored_chunk(chunk->cx, chunk->cy, chunk->cz, chunk->block_count, NULL, offset, (uint32_t)length);
+    }
+    destroy_chunk(chunk);
+    instances_dirty = 1;
+    stream_evictions++;
+    return 1;
+}
+
+// Function to queue a read of a stored chunk on the I/O thread
+void request_stream_load(uint32_t slot) {
+    if (!stream_thread_started) {
+        if (pthread_create(&stream_thread, NULL, stream_io_main, NULL) != 0) {
+            stream_in_now(slot); // No thread: read it here
+            return;
+        }
+        stream_thread_started = 1;
+    }
+    StoredChunk *entry = &stored_chunks[slot];
+    StreamRequest *request = (StreamRequest *)calloc(1, sizeof(StreamRequest));
+    if (request == NULL) {
+        fprintf(stderr, "Memory allocation failed for stream request.\n");
+        exit(EXIT_FAILURE);
+    }
+    request->key = pack_coords(entry->cx, entry->cy, entry->cz);
+    request->map = entry->map;
+    if (request->map) request->map->references++;
+    request->offset = entry->offset;
+    request->length = entry->length;
+    request->block_count = entry->block_count;
+    request->requested = now_seconds();
+    entry->loading = 1;
+    stream_in_flight++;
+
+    pthread_mutex_lock(&stream_lock);
+    if (stream_queue_tail) stream_queue_tail->next = request;
+    else stream_queue_head = request;
+    stream_queue_tail = request;
+    pthread_cond_signal(&stream_ready);
+    pthread_mutex_unlock(&stream_lock);
+}
+
+// Function to make finished reads resident. A read is dropped when its chunk was brought back
+// meanwhile, or was streamed out again to a different place.
+void finish_stream_loads(void) {
+    pthread_mutex_lock(&stream_lock);
+    StreamRequest *done = stream_done;
+    stream_done = NULL;
+    pthread_mutex_unlock(&stream_lock);
+
+    double now = now_seconds();
+    while (done) {
+        StreamRequest *request = done;
+        done = request->next;
+        stream_in_flight--;
+        uint32_t slot = coord_map_find(&stored_index, request->key);
+        if (slot != COORD_NOT_FOUND && stored_chunks[slot].loading && stored_chunks[slot].map == request->map &&
+            stored_chunks[slot].offset == request->offset) {
+            stream_in_chunk(slot, request->blocks);
+            request->blocks = NULL;
+            stream_loads++;
+            stats_record(PHASE_STREAM_LOAD, now - request->requested);
+        }
+        request->next = NULL;
+        free_stream_requests(request);
+    }
+}
+
+// Function to order (distance, key) pairs, nearest first
+int compare_wanted(const void *a, const void *b) {
+    const uint64_t *x = (const uint64_t *)a, *y = (const uint64_t *)b;
+    return (x[0] > y[0]) - (x[0] < y[0]);
+}
+
+// Function to list the stored chunks in range of the player, nearest first
+void rebuild_stream_wanted(const int32_t center[3]) {
+    int64_t radius = world_stream_radius, radius2 = radius * radius;
+    uint64_t *pairs = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t side = (uint64_t)(2 * radius + 1);
+    int scan_box = side * side * side <= stored_count;
+    size_t total = scan_box ? (size_t)(side * side * side) : stored_count;
+    for (size_t i = 0; i < total; i++) {
+        int32_t c[3];
+        if (scan_box) {
+            c[0] = center[0] - (int32_t)radius + (int32_t)(i % side);
+            c[2] = center[2] - (int32_t)radius + (int32_t)(i / side % side);
+            c[1] = center[1] - (int32_t)radius + (int32_t)(i / side / side);
+            if (c[0] < -(COORD_LIMIT >> CHUNK_SHIFT) || c[0] >= (COORD_LIMIT >> CHUNK_SHIFT) ||
+                c[1] < -(COORD_LIMIT >> CHUNK_SHIFT) || c[1] >= (COORD_LIMIT >> CHUNK_SHIFT) ||
+                c[2] < -(COORD_LIMIT >> CHUNK_SHIFT) || c[2] >= (COORD_LIMIT >> CHUNK_SHIFT) ||
+                coord_map_find(&stored_index, pack_coords(c[0], c[1], c[2])) == COORD_NOT_FOUND) {
+                continue;
+            }
+        } else {
+            c[0] = stored_chunks[i].cx;
+            c[1] = stored_chunks[i].cy;
+            c[2] = stored_chunks[i].cz;
+        }
+        int64_t distance2 = chunk_distance2(center, c[0], c[1], c[2]);
+        if (distance2 > radius2) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            uint64_t *new_pairs = (uint64_t *)realloc(pairs, capacity * 2 * sizeof(uint64_t));
+            if (new_pairs == NULL) {
+                fprintf(stderr, "Memory allocation failed for stream list.\n");
+                exit(EXIT_FAILURE);
+            }
+            pairs = new_pairs;
+        }
+        pairs[2 * count] = (uint64_t)distance2;
+        pairs[2 * count + 1] = pack_coords(c[0], c[1], c[2]);
+        count++;
+    }
+    if (count > 0) qsort(pairs, count, 2 * sizeof(uint64_t), compare_wanted);
+
+    if (count > stream_wanted_capacity) {
+        uint64_t *new_wanted = (uint64_t *)realloc(stream_wanted, count * sizeof(uint64_t));
+        if (new_wanted == NULL) {
+            fprintf(stderr, "Memory allocation failed for stream list.\n");
+            exit(EXIT_FAILURE);
+        }
+        stream_wanted = new_wanted;
+        stream_wanted_capacity = count;
+    }
+    for (size_t i = 0; i < count; i++) {
+        stream_wanted[i] = pairs[2 * i + 1];
+    }
+    free(pairs);
+    stream_wanted_count = count;
+    stream_wanted_next = 0;
+    memcpy(stream_center, center, sizeof(stream_center));
+    stream_center_valid = 1;
+}
+
+// Function to order (distance, chunk index) pairs, farthest first
+int compare_evictions(const void *a, const void *b) {
+    const uint64_t *x = (const uint64_t *)a, *y = (const uint64_t *)b;
+    return (x[0] < y[0]) - (x[0] > y[0]);
+}
+
+// Function to evict the chunks farthest from the player until resident_bytes (exact on entry) is
+// at most target; the chunk a caller is still using can be kept
+void stream_evict_farthest(const int32_t center[3], size_t target, const Chunk *keep) {
+    uint64_t *pairs = (uint64_t *)malloc(chunk_count * 2 * sizeof(uint64_t));
+    if (pairs == NULL) {
+        fprintf(stderr, "Memory allocation failed for eviction list.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < chunk_count; i++) {
+        pairs[2 * i] = (uint64_t)chunk_distance2(center, chunks[i]->cx, chunks[i]->cy, chunks[i]->cz);
+        pairs[2 * i + 1] = pack_coords(chunks[i]->cx, chunks[i]->cy, chunks[i]->cz);
+    }
+    qsort(pairs, chunk_count, 2 * sizeof(uint64_t), compare_evictions);
+    size_t count = chunk_count;
+    for (size_t i = 0; i < count && resident_bytes > target; i++) {
+        uint32_t index = coord_map_find(&chunk_index, pairs[2 * i + 1]);
+        Chunk *chunk = chunks[index];
+        if (chunk == keep) continue;
+        size_t bytes = chunk_memory(chunk);
+        if (!evict_chunk(chunk)) break;
+        resident_bytes -= bytes;
+    }
+    free(pairs);
+}
+
+// Function to hold the memory cap between frames: called as chunks become resident (edits,
+// immediate loads, loaded worlds) and after each edit, with resident_bytes raised as they grow.
+// Past the cap, the farthest chunks are evicted down to 7/8 of it, so building a large world does
+// not sort the chunks again for every new one. The chunk a caller is still using can be kept.
+void stream_hold_cap(const Chunk *keep) {
+    if (world_stream_radius == 0 || world_memory_cap == 0 || resident_bytes <= world_memory_cap) return;
+    resident_bytes = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        resident_bytes += chunk_memory(chunks[i]);
+    }
+    if (resident_bytes <= world_memory_cap) return;
+    int32_t center[3];
+    player_chunk(center);
+    stream_evict_farthest(center, world_memory_cap - world_memory_cap / 8, keep);
+}
+
+// Function to stream chunks around the player once per frame: pick up finished reads, evict chunks
+// out of range (and the farthest ones while over the memory cap), then queue reads of stored
+// chunks in range, nearest first, while there is room under the cap
+void stream_update(void) {
+    finish_stream_loads();
+    int32_t center[3];
+    player_chunk(center);
+    int64_t radius2 = (int64_t)world_stream_radius * world_stream_radius;
+
+    // Going backwards keeps the walk valid when destroy_chunk() moves the last chunk down
+    size_t evicted = 0;
+    resident_bytes = 0;
+    for (size_t i = chunk_count; i-- > 0; ) {
+        Chunk *chunk = chunks[i];
+        if (evicted < STREAM_EVICTIONS_PER_FRAME && chunk_distance2(center, chunk->cx, chunk->cy, chunk->cz) > radius2) {
+            if (!evict_chunk(chunk)) return;
+            evicted++;
+            continue;
+        }
+        resident_bytes += chunk_memory(chunk);
+    }
+
+    if (world_memory_cap > 0 && resident_bytes > world_memory_cap) {
+        stream_evict_farthest(center, world_memory_cap, NULL);
+    }
+
+    if (!stream_center_valid || memcmp(center, stream_center, sizeof(center)) != 0) rebuild_stream_wanted(center);
+    size_t load_bytes = sizeof(Chunk) + CHUNK_VOLUME * sizeof(uint16_t);
+    while (stream_wanted_next < stream_wanted_count && stream_in_flight < STREAM_LOADS_IN_FLIGHT) {
+        if (world_memory_cap > 0 && resident_bytes + (stream_in_flight + 1) * load_bytes > world_memory_cap) break;
+        uint32_t slot = coord_map_find(&stored_index, stream_wanted[stream_wanted_next++]);
+        if (slot == COORD_NOT_FOUND || stored_chunks[slot].loading) continue;
+        request_stream_load(slot);
+    }
+}
+
+// Function to drop every stored chunk and empty the spill file, once no read refers to them
+void clear_stored_chunks(void) {
+    stop_stream_thread();
+    for (size_t i = 0; i < stored_count; i++) {
+        if (stored_chunks[i].map) release_world_map(stored_chunks[i].map);
+    }
+    free(stored_chunks);
+    stored_chunks = NULL;
+    stored_count = stored_capacity = 0;
+    coord_map_free(&stored_index);
+    if (spill_fd >= 0 && ftruncate(spill_fd, 0) != 0) {
+        close(spill_fd); // A fresh file is made on the next eviction
+        spill_fd = -1;
+    }
+    spill_end = 0;
+    for (int size_class = 0; size_class < SPILL_CLASSES; size_class++) {
+        free(spill_free_lists[size_class].offsets);
+        memset(&spill_free_lists[size_class], 0, sizeof(SpillFreeList));
+    }
+    stream_wanted_count = stream_wanted_next = 0;
+    stream_center_valid = 0;
+}
+
+// Function to turn streaming on or off and set the memory cap (command entry point)
+void neko_stream_world(int radius, size_t cap_bytes) {
+    world_stream_radius = radius;
+    world_memory_cap = cap_bytes;
+    stream_center_valid = 0;
+    if (radius == 0) {
+        // Reads still queued are cancelled, and everything comes back right away
+        stop_stream_thread();
+        int32_t lo[3] = { -(COORD_LIMIT >> CHUNK_SHIFT), -(COORD_LIMIT >> CHUNK_SHIFT), -(COORD_LIMIT >> CHUNK_SHIFT) };
+        int32_t hi[3] = { (COORD_LIMIT >> CHUNK_SHIFT) - 1, (COORD_LIMIT >> CHUNK_SHIFT) - 1, (COORD_LIMIT >> CHUNK_SHIFT) - 1 };
+        stream_in_range(lo, hi);
+    } else {
+        // The cap holds from now on, even if no frame is drawn
+        resident_bytes = 0;
+        for (size_t i = 0; i < chunk_count; i++) {
+            resident_bytes += chunk_memory(chunks[i]);
+        }
+        stream_hold_cap(NULL);
+    }
+    if (verbose) {
+        if (radius > 0) {
+            output_printf("World streaming radius set to %d chunks, memory cap %.1f MiB%s.\n", radius,
+                          (double)cap_bytes / (1024.0 * 1024.0), cap_bytes ? "" : " (none)");
+        } else {
+            output_printf("World streaming off; %zu chunks resident.\n", chunk_count);
+        }
+    }
+}
+
+// Function to print the streaming counters and load latency
+void neko_stream_stats(void) {
+    double p[4];
+    stats_percentiles(PHASE_STREAM_LOAD, p);
+    resident_bytes = 0;
+    for (size_t i = 0; i < chunk_count; i++) {
+        resident_bytes += chunk_memory(chunks[i]);
+    }
+    output_printf("Streaming: %zu chunks resident (%.1f MiB), %zu stored, %zu loading; %zu loads "
+                  "(p50 %.2f ms, p95 %.2f ms, max %.2f ms), %zu immediate, %zu evictions.\n",
+                  chunk_count, (double)resident_bytes / (1024.0 * 1024.0), stored_count, stream_in_flight,
+                  stream_loads, p[0], p[1], p[3], stream_sync_loads, stream_evictions);
+}
+
+// Function to look up a render mode by name; returns -1 for an unknown name
+int parse_render_mode(const char *name, size_t length) {
+    for (int mode = 0; mode < (int)(sizeof(render_mode_names) / sizeof(render_mode_names[0])); mode++) {
+        if (strncmp(render_mode_names[mode], name, length) == 0 && render_mode_names[mode][length] == '\0') {
+            return mode;
+        }
+    }
+    return -1;
+}
+
+// Function to look up a world storage by name; returns -1 for an unknown name
+int parse_world_storage(const char *name, size_t length) {
+    for (int storage = 0; storage < (int)(sizeof(storage_names) / sizeof(storage_names[0])); storage++) {
+        if (strncmp(storage_names[storage], name, length) == 0 && storage_names[storage][length] == '\0') {
+            return storage;
+        }
+    }
+    return -1;
+}
+
+// Function to switch the storage of the world's resident chunks (stored chunks switch as they come back)
+void neko_world_storage(WorldStorage storage) {
+    size_t before = 0, after = 0;
+    world_storage = storage;
+    for (size_t i = 0; i < chunk_count; i++) {
+        before += chunk_memory(chunks[i]);
+        chunk_apply_storage(chunks[i]);
+        after += chunk_memory(chunks[i]);
+    }
+    if (verbose) {
+        output_printf("World storage set to %s: %zu chunks, %.2f MiB before, %.2f MiB after.\n",
+                      storage_names[storage], chunk_count, (double)before / (1024.0 * 1024.0),
+                      (double)after / (1024.0 * 1024.0));
+    }
+}
+
+// Function to create an OpenGL window
+void neko_window(const char *title, int width, int height) {
+    if (!glfwInit()) {
+        fprintf(stderr, "GLFW initialization failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Configure GLFW for OpenGL 3.3 Core Profile
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE); // Enable double buffering
+
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // Necessary for Mac
+#endif
+
+    // Create the GLFW window
+    snprintf(window_title, sizeof(window_title), "%s", title);
+    gl_window = glfwCreateWindow(width, height, title, NULL, NULL);
+    if (!gl_window) {
+        fprintf(stderr, "Failed to create GLFW window.\n");
+        glfwTerminate();
+        exit(EXIT_FAILURE);
     }
 
     // Make the OpenGL context current
@@ -458,280 +3602,1300 @@ void neko_window(const char *title, int width, int height) {
     // Enable V-Sync
     glfwSwapInterval(1);
 
-    // Initialize GLEW
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "GLEW initialization failed.\n");
-        glfwDestroyWindow(gl_window);
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+    // Initialize GLEW
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) {
+        fprintf(stderr, "GLEW initialization failed.\n");
+        glfwDestroyWindow(gl_window);
+        glfwTerminate();
+        exit(EXIT_FAILURE);
+    }
+
+    // Set the viewport
+    int fbWidth, fbHeight;
+    glfwGetFramebufferSize(gl_window, &fbWidth, &fbHeight);
+    glViewport(0, 0, fbWidth, fbHeight);
+
+    // Setup OpenGL objects (VAO, VBO, Shaders)
+    setup_opengl_objects();
+}
+
+// Function to create an offscreen OpenGL 3.3 context and framebuffer instead of a window (--headless)
+void neko_headless_window(int width, int height) {
+#ifdef NEKO_WITH_EGL
+    // Prefer Mesa's surfaceless platform, which needs no display server or GPU
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display) {
+        egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (egl_display == EGL_NO_DISPLAY) egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, NULL, NULL)) {
+        fprintf(stderr, "EGL initialization failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Configure EGL for an OpenGL 3.3 Core Profile context without a surface
+    // (the default surface type is a window, which the surfaceless platform does not offer)
+    const EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    const EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint config_count = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) ||
+        !eglChooseConfig(egl_display, config_attributes, &config, 1, &config_count) || config_count == 0 ||
+        (egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attributes)) == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)) {
+        fprintf(stderr, "Failed to create headless OpenGL context.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Load GL entry points only; glewInit() would look for a window-system connection
+    glewExperimental = GL_TRUE;
+    if (glewContextInit() != GLEW_OK) {
+        fprintf(stderr, "GLEW initialization failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Render into a framebuffer object the size the script asked for
+    glGenFramebuffers(1, &headless_FBO);
+    glGenRenderbuffers(1, &headless_color_RBO);
+    glGenRenderbuffers(1, &headless_depth_RBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_color_RBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_depth_RBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_color_RBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, headless_depth_RBO);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Headless framebuffer is incomplete.\n");
+        exit(EXIT_FAILURE);
+    }
+    headless_width = width;
+    headless_height = height;
+    glViewport(0, 0, width, height);
+
+    // Setup OpenGL objects (VAO, VBO, Shaders)
+    setup_opengl_objects();
+#else
+    (void)width;
+    (void)height;
+    fprintf(stderr, "Headless mode is not available: build with NEKO_WITH_EGL.\n");
+    exit(EXIT_FAILURE);
+#endif
+}
+
+// Function to release the headless context and framebuffer
+void headless_shutdown(void) {
+    if (headless_FBO) {
+        glDeleteFramebuffers(1, &headless_FBO);
+        glDeleteRenderbuffers(1, &headless_color_RBO);
+        glDeleteRenderbuffers(1, &headless_depth_RBO);
+        headless_FBO = headless_color_RBO = headless_depth_RBO = 0;
+    }
+#ifdef NEKO_WITH_EGL
+    if (egl_display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (egl_context != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_context);
+        eglTerminate(egl_display);
+        egl_display = EGL_NO_DISPLAY;
+        egl_context = EGL_NO_CONTEXT;
+    }
+#endif
+}
+
+// Function to read the monotonic clock in seconds
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Function to add one sample to a phase's rolling window
+void stats_record(TimerPhase phase, double seconds) {
+    PhaseStats *stats = &phase_stats[phase];
+    stats->samples[stats->next] = seconds;
+    stats->next = (stats->next + 1) % STATS_WINDOW;
+    if (stats->count < STATS_WINDOW) stats->count++;
+    stats->total_count++;
+    stats->total += seconds;
+}
+
+// Function to order samples for qsort
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to compute p50, p95, p99 and the maximum of a phase's window, in milliseconds
+void stats_percentiles(TimerPhase phase, double out[4]) {
+    const PhaseStats *stats = &phase_stats[phase];
+    double sorted[STATS_WINDOW];
+    memset(out, 0, 4 * sizeof(double));
+    if (stats->count == 0) return;
+    memcpy(sorted, stats->samples, stats->count * sizeof(double));
+    qsort(sorted, stats->count, sizeof(double), compare_doubles);
+    const double ranks[3] = { 0.50, 0.95, 0.99 };
+    for (int i = 0; i < 3; i++) {
+        size_t index = (size_t)(ranks[i] * (double)(stats->count - 1) + 0.5); // Nearest rank
+        out[i] = sorted[index] * 1000.0;
+    }
+    out[3] = sorted[stats->count - 1] * 1000.0;
+}
+
+// Function to open the GPU timer query for this frame
+void gpu_timer_begin(void) {
+    if (gpu_queries[0] == 0) glGenQueries(2, gpu_queries);
+    glBeginQuery(GL_TIME_ELAPSED, gpu_queries[gpu_query_frame & 1]);
+}
+
+// Function to close this frame's GPU timer query and collect the previous frame's result if it is ready
+void gpu_timer_end(void) {
+    size_t current = gpu_query_frame & 1, previous = current ^ 1;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpu_query_pending[current] = 1;
+    if (gpu_query_pending[previous]) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(gpu_queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(gpu_queries[previous], GL_QUERY_RESULT, &nanoseconds);
+
+            // Some drivers (llvmpipe) report a timestamp instead of a duration for the first query
+            if (gpu_query_frame > 1) stats_record(PHASE_GPU, (double)nanoseconds * 1e-9);
+        }
+        gpu_query_pending[previous] = 0; // An unread result is dropped rather than waited for
+    }
+    gpu_query_frame++;
+}
+
+// Function to print the frame stats once a second in verbose mode and refresh the title overlay
+void stats_report(double now) {
+    if (stats_last_report == 0.0) {
+        stats_last_report = now;
+        return;
+    }
+    if (now - stats_last_report < 1.0) return;
+    size_t frames = phase_stats[PHASE_FRAME].total_count - stats_frames_at_report;
+    double fps = (double)frames / (now - stats_last_report);
+    double frame[4], part[4];
+    stats_percentiles(PHASE_FRAME, frame);
+    if (verbose) {
+        output_printf("Frame stats: %.1f fps, frame p50 %.2f ms, p95 %.2f ms, p99 %.2f ms; p50",
+                      fps, frame[0], frame[1], frame[2]);
+        for (int phase = 0; phase < PHASE_FRAME; phase++) {
+            stats_percentiles((TimerPhase)phase, part);
+            output_printf(" %s %.2f ms%s", phase_names[phase], part[0], phase < PHASE_FRAME - 1 ? "," : ".\n");
+        }
+    }
+    if (stats_overlay && gl_window) {
+        char title[sizeof(window_title) + 96];
+        snprintf(title, sizeof(title), "%s | %.0f fps | p50 %.1f ms p95 %.1f ms p99 %.1f ms",
+                 window_title, fps, frame[0], frame[1], frame[2]);
+        glfwSetWindowTitle(gl_window, title);
+    }
+    stats_last_report = now;
+    stats_frames_at_report = phase_stats[PHASE_FRAME].total_count;
+}
+
+// Function to write the per-phase stats as CSV, or as JSON when the file name ends in .json
+void write_stats_file(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to write stats to %s\n", path);
+        return;
+    }
+    size_t length = strlen(path);
+    int json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+    if (json) fprintf(file, "{\n  \"window\": %d,\n  \"phases\": {\n", STATS_WINDOW);
+    else fprintf(file, "phase,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        const PhaseStats *stats = &phase_stats[phase];
+        double p[4];
+        stats_percentiles((TimerPhase)phase, p);
+        double mean = stats->total_count ? stats->total * 1000.0 / (double)stats->total_count : 0.0;
+        if (json) {
+            fprintf(file, "    \"%s\": {\"samples\": %zu, \"mean_ms\": %.4f, \"p50_ms\": %.4f, "
+                          "\"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+                    phase_names[phase], stats->total_count, mean, p[0], p[1], p[2], p[3],
+                    phase < PHASE_COUNT - 1 ? "," : "");
+        } else {
+            fprintf(file, "%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                    phase_names[phase], stats->total_count, mean, p[0], p[1], p[2], p[3]);
+        }
+    }
+    if (json) fprintf(file, "  }\n}\n");
+    fclose(file);
+    if (verbose) output_printf("Frame stats written to %s.\n", path);
+}
+
+// Function to render one frame and present it, timing each phase
+void render_frame(void) {
+    double start = now_seconds();
+    if (frame_started == 0.0) frame_started = start;
+    stats_record(PHASE_SCRIPT, start - frame_started);
+
+    frame_remesh_time = 0.0;
+    gpu_timer_begin();
+    neko_draw_scene();
+    gpu_timer_end();
+    double drawn = now_seconds();
+    stats_record(PHASE_REMESH, frame_remesh_time);
+    stats_record(PHASE_DRAW, drawn - start - frame_remesh_time);
+
+    if (headless_mode) {
+        glFinish(); // Count the time the renderer takes, not just command submission
+    } else {
+        glfwSwapBuffers(gl_window);
+        glfwPollEvents();
+    }
+    double end = now_seconds();
+    stats_record(PHASE_PRESENT, end - drawn);
+    stats_record(PHASE_FRAME, end - frame_started);
+    frame_started = end;
+    stats_report(end);
+}
+
+// Function to mesh every queued chunk before a frame whose pixels must not depend on timing
+void remesh_all_chunks(void) {
+    size_t budget = remesh_budget;
+    remesh_budget = 0;
+    for (;;) {
+        remesh_dirty_chunks();
+        if (remesh_count == 0 && jobs_in_flight == 0) break;
+        struct timespec pause = {0, 100000}; // Results come back from the workers
+        nanosleep(&pause, NULL);
+    }
+    remesh_budget = budget;
+}
+
+// Function to write the current headless frame to a binary PPM file and return its checksum
+// (64-bit FNV-1a over the rows, top to bottom)
+uint64_t dump_frame(const char *path) {
+    size_t row = (size_t)headless_width * 3;
+    unsigned char *pixels = (unsigned char *)malloc(row * (size_t)headless_height);
+    if (pixels == NULL) {
+        fprintf(stderr, "Memory allocation failed for frame dump.\n");
+        exit(EXIT_FAILURE);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, headless_width, headless_height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+    FILE *file = path ? fopen(path, "wb") : NULL;
+    if (path && file == NULL) fprintf(stderr, "Error: Unable to write frame to %s\n", path);
+    if (file) fprintf(file, "P6\n%d %d\n255\n", headless_width, headless_height);
+
+    // OpenGL returns the bottom row first; images start at the top
+    uint64_t checksum = 0xcbf29ce484222325ull;
+    for (int y = headless_height - 1; y >= 0; y--) {
+        const unsigned char *line = pixels + (size_t)y * row;
+        for (size_t i = 0; i < row; i++) {
+            checksum = (checksum ^ line[i]) * 0x100000001b3ull;
+        }
+        if (file) fwrite(line, 1, row, file);
+    }
+    if (file) fclose(file);
+    free(pixels);
+    return checksum;
+}
+
+// Function to render the fixed number of headless frames and report their times
+void run_headless_frames(void) {
+    // Frames drawn by the script itself are not part of the benchmark
+    memset(phase_stats, 0, sizeof(phase_stats));
+    frame_started = 0.0;
+    for (int frame = 0; frame < headless_frames; frame++) {
+        render_frame();
+    }
+    const PhaseStats *frames = &phase_stats[PHASE_FRAME];
+    if (frames->total_count > 0) {
+        double p[4], gpu[4];
+        stats_percentiles(PHASE_FRAME, p);
+        stats_percentiles(PHASE_GPU, gpu);
+        output_printf("Rendered %d frames at %dx%d: avg %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, max %.3f ms"
+                      " (gpu p50 %.3f ms).\n",
+                      headless_frames, headless_width, headless_height,
+                      frames->total * 1000.0 / (double)frames->total_count, p[0], p[1], p[2], p[3], gpu[0]);
+    }
+
+    // Final frame with every chunk meshed, so its checksum is reproducible
+    remesh_all_chunks();
+    neko_draw_scene();
+    glFinish();
+    uint64_t checksum = dump_frame(dump_frame_path);
+    output_printf("Frame checksum: %016llx\n", (unsigned long long)checksum);
+    if (dump_frame_path) output_printf("Frame written to %s.\n", dump_frame_path);
+}
+
+// Function to check if a key is pressed
+int is_key_pressed(const char *key) {
+    if (!opengl_initialized || !gl_window) {
+        return 0;
+    }
+
+    if (strcmp(key, "W") == 0) {
+        return glfwGetKey(gl_window, GLFW_KEY_W) == GLFW_PRESS;
+    } else if (strcmp(key, "S") == 0) {
+        return glfwGetKey(gl_window, GLFW_KEY_S) == GLFW_PRESS;
+    } else if (strcmp(key, "A") == 0) {
+        return glfwGetKey(gl_window, GLFW_KEY_A) == GLFW_PRESS;
+    } else if (strcmp(key, "D") == 0) {
+        return glfwGetKey(gl_window, GLFW_KEY_D) == GLFW_PRESS;
+    } else if (strcmp(key, "ESC") == 0) {
+        return glfwGetKey(gl_window, GLFW_KEY_ESCAPE) == GLFW_PRESS;
+    }
+
+    return 0;
+}
+
+// Function to set the player's position
+void neko_set_player_position(float x, float y, float z) {
+    player_x = x;
+    player_y = y;
+    player_z = z;
+    camera_dirty = 1;
+    if (verbose) output_printf("Player position updated to (%.2f, %.2f, %.2f)\n", player_x, player_y, player_z);
+}
+
+// Function to append a word to the bytecode
+void emit(Bytecode *bc, uint32_t word) {
+    if (bc->code_count == bc->code_capacity) {
+        size_t new_capacity = bc->code_capacity ? bc->code_capacity * 2 : 256;
+        uint32_t *new_code = (uint32_t *)realloc(bc->code, new_capacity * sizeof(uint32_t));
+        if (new_code == NULL) {
+            fprintf(stderr, "Memory allocation failed for bytecode.\n");
+            exit(EXIT_FAILURE);
+        }
+        bc->code = new_code;
+        bc->code_capacity = new_capacity;
+    }
+    bc->code[bc->code_count++] = word;
+}
+
+// Function to append a float operand to the bytecode
+void emit_float(Bytecode *bc, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    emit(bc, bits);
+}
+
+// Function to add a string to the constant pool and return its index
+uint32_t add_string_constant(Bytecode *bc, const char *str, size_t length) {
+    if (bc->string_count == bc->string_capacity) {
+        size_t new_capacity = bc->string_capacity ? bc->string_capacity * 2 : 64;
+        NekoString *new_strings = (NekoString *)realloc(bc->strings, new_capacity * sizeof(NekoString));
+        if (new_strings == NULL) {
+            fprintf(stderr, "Memory allocation failed for constant pool.\n");
+            exit(EXIT_FAILURE);
+        }
+        bc->strings = new_strings;
+        bc->string_capacity = new_capacity;
+    }
+    NekoString *constant = &bc->strings[bc->string_count];
+    memset(constant, 0, sizeof(*constant));
+    string_assign(constant, str, length);
+    return (uint32_t)bc->string_count++;
+}
+
+// Function to emit an instruction that reports an error when it is reached
+void emit_error(Bytecode *bc, const char *message) {
+    emit(bc, OP_ERROR);
+    emit(bc, add_string_constant(bc, message, strlen(message)));
+}
+
+// Function to emit a message that is only printed in verbose mode
+void emit_trace(Bytecode *bc, const char *message) {
+    if (!verbose) return;
+    emit(bc, OP_TRACE);
+    emit(bc, add_string_constant(bc, message, strlen(message)));
+}
+
+// Function to empty a compiled script while keeping its buffers for the next batch
+void reset_bytecode(Bytecode *bc) {
+    for (size_t i = 0; i < bc->string_count; i++) {
+        string_free(&bc->strings[i]);
+    }
+    bc->string_count = 0;
+    bc->code_count = 0;
+}
+
+// Function to release a compiled script
+void free_bytecode(Bytecode *bc) {
+    reset_bytecode(bc);
+    free(bc->strings);
+    free(bc->code);
+    memset(bc, 0, sizeof(*bc));
+}
+
+// Function to check for the end of the source
+int lex_at_end(const Lexer *lex) {
+    return lex->pos >= lex->length;
+}
+
+// Function to look at the current character without consuming it ('\0' at the end)
+char lex_peek(const Lexer *lex) {
+    return lex->pos < lex->length ? lex->source[lex->pos] : '\0';
+}
+
+// Function to skip blanks inside a statement (never newlines)
+void lex_skip_blanks(Lexer *lex) {
+    while (lex->pos < lex->length) {
+        char c = lex->source[lex->pos];
+        if (c != ' ' && c != '\t' && c != '\r') break;
+        lex->pos++;
     }
+}
 
-    // Set the viewport
-    int fbWidth, fbHeight;
-    glfwGetFramebufferSize(gl_window, &fbWidth, &fbHeight);
-    glViewport(0, 0, fbWidth, fbHeight);
+// Function to skip the rest of the current line, including its newline
+void lex_skip_line(Lexer *lex) {
+    const char *newline = memchr(lex->source + lex->pos, '\n', lex->length - lex->pos);
+    lex->pos = newline ? (size_t)(newline - lex->source) + 1 : lex->length;
+}
 
-    // Setup OpenGL objects (VAO, VBO, Shaders)
-    setup_opengl_objects();
+// Function to read the next token as a span over the source
+Token lex_next(Lexer *lex) {
+    Token token;
+    lex_skip_blanks(lex);
+    token.span.offset = lex->pos;
+    token.span.length = 0;
+    if (lex_at_end(lex)) {
+        token.kind = TOKEN_END;
+        return token;
+    }
+
+    const char *s = lex->source;
+    size_t start = lex->pos;
+    char c = s[start];
+    if (c == '\n') {
+        token.kind = TOKEN_NEWLINE;
+        lex->pos++;
+    } else if (isalpha((unsigned char)c) || c == '_') {
+        token.kind = TOKEN_IDENTIFIER;
+        while (lex->pos < lex->length && (isalnum((unsigned char)s[lex->pos]) || s[lex->pos] == '_')) {
+            lex->pos++;
+        }
+    } else if (isdigit((unsigned char)c) || c == '.' ||
+               ((c == '-' || c == '+') && start + 1 < lex->length &&
+                (isdigit((unsigned char)s[start + 1]) || s[start + 1] == '.'))) {
+        token.kind = TOKEN_NUMBER;
+        lex->pos++;
+        while (lex->pos < lex->length) {
+            char d = s[lex->pos];
+            if (isalnum((unsigned char)d) || d == '.') {
+                lex->pos++;
+            } else if ((d == '-' || d == '+') && (s[lex->pos - 1] == 'e' || s[lex->pos - 1] == 'E')) {
+                lex->pos++; // Exponent sign
+            } else {
+                break;
+            }
+        }
+    } else if (c == '"') {
+        // The span covers the contents only; an unterminated string is reported as an error token
+        const char *close = memchr(s + start + 1, '"', lex->length - start - 1);
+        const char *newline = memchr(s + start + 1, '\n', lex->length - start - 1);
+        if (close == NULL || (newline != NULL && newline < close)) {
+            token.kind = TOKEN_ERROR;
+            lex->pos = newline ? (size_t)(newline - s) : lex->length;
+        } else {
+            token.kind = TOKEN_STRING;
+            token.span.offset = start + 1;
+            token.span.length = (size_t)(close - s) - start - 1;
+            lex->pos = (size_t)(close - s) + 1;
+            return token;
+        }
+    } else {
+        token.kind = TOKEN_SYMBOL;
+        lex->pos++;
+    }
+    token.span.length = lex->pos - start;
+    return token;
 }
 
-// Function to check if a key is pressed
-int is_key_pressed(const char *key) {
-    if (!opengl_initialized || !gl_window) {
-        return 0;
+// Function to read raw text up to a stop character, ';' or the end of the line (quotes are kept whole)
+Span lex_raw(Lexer *lex, char stop) {
+    lex_skip_blanks(lex);
+    Span span = {lex->pos, 0};
+    int in_string = 0;
+    while (lex->pos < lex->length) {
+        char c = lex->source[lex->pos];
+        if (c == '\n') break;
+        if (c == '"') in_string = !in_string;
+        if (!in_string && (c == ';' || c == stop)) break;
+        lex->pos++;
     }
 
-    if (strcmp(key, "W") == 0) {
-        return glfwGetKey(gl_window, GLFW_KEY_W) == GLFW_PRESS;
-    } else if (strcmp(key, "S") == 0) {
-        return glfwGetKey(gl_window, GLFW_KEY_S) == GLFW_PRESS;
-    } else if (strcmp(key, "A") == 0) {
-        return glfwGetKey(gl_window, GLFW_KEY_A) == GLFW_PRESS;
-    } else if (strcmp(key, "D") == 0) {
-        return glfwGetKey(gl_window, GLFW_KEY_D) == GLFW_PRESS;
-    } else if (strcmp(key, "ESC") == 0) {
-        return glfwGetKey(gl_window, GLFW_KEY_ESCAPE) == GLFW_PRESS;
+    // Drop trailing blanks
+    size_t end = lex->pos;
+    while (end > span.offset && (lex->source[end - 1] == ' ' || lex->source[end - 1] == '\t' || lex->source[end - 1] == '\r')) {
+        end--;
     }
+    span.length = end - span.offset;
+    return span;
+}
 
+// Function to consume the end of a statement (';', newline or end of input); returns 0 if something else follows
+int lex_end_statement(Lexer *lex) {
+    lex_skip_blanks(lex);
+    if (lex_at_end(lex)) return 1;
+    char c = lex_peek(lex);
+    if (c == '\n') {
+        lex->pos++;
+        return 1;
+    }
+    if (c == ';') {
+        while (lex_peek(lex) == ';') lex->pos++;
+        return 1;
+    }
     return 0;
 }
 
-// Function to set the player's position
-void neko_set_player_position(float x, float y, float z) {
-    player_x = x;
-    player_y = y;
-    player_z = z;
-    if (verbose) printf("Player position updated to (%.2f, %.2f, %.2f)\n", player_x, player_y, player_z);
+// Function to check whether a span holds a quoted string, returning its contents in *inner
+int span_unquote(const char *source, Span span, Span *inner) {
+    if (span.length >= 2 && source[span.offset] == '"' && source[span.offset + span.length - 1] == '"') {
+        inner->offset = span.offset + 1;
+        inner->length = span.length - 2;
+        return 1;
+    }
+    *inner = span;
+    return 0;
 }
 
-// Function to interpret and execute NekoLang code
-void interpret(const char *code, int gui_mode) {
-    char line[1024];          // Buffer for each line of code
-    const char *ptr = code;   // Pointer to traverse the code
-    int in_neko_block = 0;    // Flag to check if inside a 'neko { }' block
-    int local_opengl_mode = gui_mode; // Local OpenGL mode based on initial scan
-
-    while (*ptr != '\0') {
-        // Read a line of code
-        const char *line_start = ptr;
-        while (*ptr != '\n' && *ptr != '\0') {
-            ptr++;
-        }
-        size_t len = ptr - line_start;
-        if (len >= sizeof(line)) len = sizeof(line) - 1; // Limit line length
-        strncpy(line, line_start, len);
-        line[len] = '\0';
-        if (*ptr == '\n') ptr++; // Skip newline character
-
-        // Trim the line
-        char *trimmed_line = trim(line);
-
-        // Skip empty lines and comments
-        if (strlen(trimmed_line) == 0 || strncmp(trimmed_line, "//", 2) == 0) continue;
+// Function to convert a number token to a float; numbers are short, so only they are copied
+int span_to_float(const char *source, Span span, float *value) {
+    char buffer[64];
+    if (span.length == 0 || span.length >= sizeof(buffer)) return 0;
+    memcpy(buffer, source + span.offset, span.length);
+    buffer[span.length] = '\0';
+    char *end;
+    *value = strtof(buffer, &end);
+    return *end == '\0';
+}
 
-        // Check for 'neko {' to enter the block
-        if (strcmp(trimmed_line, "neko {") == 0 || strcmp(trimmed_line, "neko{") == 0) {
-            in_neko_block = 1;
-            if (verbose) printf("Entering 'neko' block.\n");
-            continue;
+// Function to read a comma-separated list of numbers; returns 0 if the arguments do not match
+int lex_numbers(Lexer *lex, float *values, int count) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            Token comma = lex_next(lex);
+            if (comma.kind != TOKEN_SYMBOL || lex->source[comma.span.offset] != ',') {
+                lex->pos = comma.span.offset; // Leave a newline for the caller
+                return 0;
+            }
         }
-
-        // Check for '}' to exit the block
-        if (strcmp(trimmed_line, "}") == 0) {
-            in_neko_block = 0;
-            if (verbose) printf("Exiting 'neko' block.\n");
-            continue;
+        Token number = lex_next(lex);
+        if (number.kind != TOKEN_NUMBER || !span_to_float(lex->source, number.span, &values[i])) {
+            lex->pos = number.span.offset;
+            return 0;
         }
+    }
+    return 1;
+}
 
-        if (!in_neko_block) {
-            continue;
+// Function to parse ", number" if the statement continues with a comma; returns 0 on a malformed number
+int lex_optional_number(Lexer *lex, float *value) {
+    lex_skip_blanks(lex);
+    if (lex_peek(lex) != ',') return 1;
+    lex->pos++;
+    Token number = lex_next(lex);
+    if (number.kind != TOKEN_NUMBER || !span_to_float(lex->source, number.span, value)) {
+        lex->pos = number.span.offset;
+        return 0;
+    }
+    return 1;
+}
+
+// Function to check that a parsed number names a block type a script may place
+int valid_block_type(float type) {
+    return type >= 1 && type <= BLOCK_TYPE_MAX && type == (float)(int)type;
+}
+
+// Function to check that a parsed number is a window side 'neko_window' can open (NaN fails too)
+int valid_window_size(float size) {
+    return size >= 1 && size <= WINDOW_SIZE_MAX;
+}
+
+// Function to hash a keyword for the perfect-hash command table (seeded FNV-1a)
+uint32_t keyword_hash(const char *text, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+// Function to generate the command table: search for a seed that maps every keyword to its own slot
+void init_keyword_table(void) {
+    size_t keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+    for (uint32_t seed = 0;; seed++) {
+        memset(keyword_table, 0, sizeof(keyword_table));
+        size_t i;
+        for (i = 0; i < keyword_count; i++) {
+            uint32_t slot = keyword_hash(keywords[i].name, strlen(keywords[i].name), seed) & (KEYWORD_TABLE_SIZE - 1);
+            if (keyword_table[slot] != 0) break;
+            keyword_table[slot] = (uint8_t)(i + 1);
+        }
+        if (i == keyword_count) {
+            keyword_seed = seed;
+            keyword_table_ready = 1;
+            return;
         }
+    }
+}
 
-        // Handle 'purr' command (print)
-        if (strncmp(trimmed_line, "purr", 4) == 0) {
-            char *msg = trim(trimmed_line + 4);
-            char output[1024] = "";
-            char *token = strtok(msg, "+");
+// Function to map a command word to its command with one hash and one compare
+Command lookup_command(const char *word, size_t length) {
+    if (!keyword_table_ready) init_keyword_table();
+    uint32_t slot = keyword_hash(word, length, keyword_seed) & (KEYWORD_TABLE_SIZE - 1);
+    uint8_t entry = keyword_table[slot];
+    if (entry == 0) return CMD_UNKNOWN;
+    const Keyword *keyword = &keywords[entry - 1];
+    if (strncmp(keyword->name, word, length) != 0 || keyword->name[length] != '\0') return CMD_UNKNOWN;
+    return keyword->command;
+}
 
-            while (token != NULL) {
-                token = trim(token);
-                size_t len = strlen(token);
-                if (len >= 2 && token[0] == '"' && token[len - 1] == '"') {
-                    token[len - 1] = '\0';
-                    strcat(output, token + 1);
-                } else {
-                    char *var_value = get_variable(token);
-                    if (var_value) {
-                        strcat(output, var_value);
-                    } else {
-                        strcat(output, "(undefined)");
-                    }
+uint32_t compile_function_body(const char *source, Span body);
+
+// Function to report a statement's arguments as invalid and skip the rest of it
+void compile_invalid(Lexer *lex, Bytecode *bc, const char *message) {
+    emit_error(bc, message);
+    lex_raw(lex, '\0');
+    lex_end_statement(lex);
+}
+
+// Function to compile one statement found inside a 'neko' block
+void compile_statement(Lexer *lex, Bytecode *bc, Token word) {
+    const char *s = lex->source;
+    char message[1200];
+    float xyz[3];
+
+    Command command = lookup_command(s + word.span.offset, word.span.length);
+    switch (command) {
+        // Handle 'purr' command (print): string literals and variables joined by '+'
+        case CMD_PURR: {
+            size_t count_at = bc->code_count;
+            uint32_t piece_count = 0;
+            emit(bc, OP_PURR);
+            emit(bc, 0); // Patched below once the pieces are known
+
+            for (;;) {
+                Span piece = lex_raw(lex, '+');
+                Span text;
+                if (span_unquote(s, piece, &text)) {
+                    emit(bc, PIECE_LITERAL);
+                    emit(bc, add_string_constant(bc, s + text.offset, text.length));
+                    piece_count++;
+                } else if (piece.length > 0) {
+                    emit(bc, PIECE_VARIABLE);
+                    emit(bc, resolve_variable(s + piece.offset, piece.length));
+                    piece_count++;
                 }
-                token = strtok(NULL, "+");
+                if (lex_peek(lex) != '+') break;
+                lex->pos++;
             }
-            printf("%s\n", output);
+            bc->code[count_at + 1] = piece_count;
+            lex_end_statement(lex);
+            break;
         }
+
         // Handle 'kitten' command (variable declaration)
-        else if (strncmp(trimmed_line, "kitten", 6) == 0) {
-            char *rest = trim(trimmed_line + 6);
-            char *equals = strchr(rest, '=');
-            if (equals) {
-                *equals = '\0';
-                char *name = trim(rest);
-                char *value = trim(equals + 1);
-
-                // Remove quotes if present
-                if (value[0] == '"' && value[strlen(value) - 1] == '"') {
-                    value++;
-                    value[strlen(value) - 1] = '\0';
-                }
-                set_variable(name, value);
-                if (verbose) printf("Variable '%s' set to '%s'.\n", name, value);
-            } else {
-                fprintf(stderr, "Syntax error in variable declaration.\n");
+        case CMD_KITTEN: {
+            Span name = lex_raw(lex, '=');
+            if (lex_peek(lex) != '=' || name.length == 0) {
+                compile_invalid(lex, bc, "Syntax error in variable declaration.");
+                break;
             }
+            lex->pos++;
+
+            // Remove quotes if present
+            Span value;
+            span_unquote(s, lex_raw(lex, '\0'), &value);
+            emit(bc, OP_KITTEN);
+            emit(bc, resolve_variable(s + name.offset, name.length));
+            emit(bc, add_string_constant(bc, s + value.offset, value.length));
+            lex_end_statement(lex);
+            break;
         }
+
         // Handle 'meow' command (user input)
-        else if (strncmp(trimmed_line, "meow", 4) == 0) {
-            char *var_name = trim(trimmed_line + 4);
-            char prompt[INPUT_SIZE];
-            snprintf(prompt, sizeof(prompt), "Enter value for %s: ", var_name);
-            char *input = get_user_input(prompt);
-            if (input == NULL || input[0] == '\0') {
-                fprintf(stderr, "Error: Input for %s is empty.\n", var_name);
-                continue;
-            }
-            set_variable(var_name, input);
-            if (verbose) printf("Variable '%s' updated with value '%s'.\n", var_name, input);
+        case CMD_MEOW: {
+            Span name = lex_raw(lex, '\0');
+            emit(bc, OP_MEOW);
+            emit(bc, resolve_variable(s + name.offset, name.length));
+            lex_end_statement(lex);
+            break;
         }
+
         // Handle 'neko_window' command (create window)
-        else if (strncmp(trimmed_line, "neko_window", 11) == 0) {
-            local_opengl_mode = 1; // Enable OpenGL mode
-            char *args = trim(trimmed_line + 11);
-            char *title = strtok(args, ",");
-            char *width_str = strtok(NULL, ",");
-            char *height_str = strtok(NULL, ",");
-
-            if (title && width_str && height_str) {
-                // Remove quotes if present
-                if (title[0] == '"' && title[strlen(title) - 1] == '"') {
-                    title[strlen(title) - 1] = '\0';
-                    title++;
-                }
-                int width = atoi(width_str);
-                int height = atoi(height_str);
-                neko_window(title, width, height);
-                if (verbose) printf("OpenGL window '%s' created with size %dx%d.\n", title, width, height);
-            } else {
-                fprintf(stderr, "Invalid arguments for 'neko_window'.\n");
+        case CMD_WINDOW: {
+            Span title;
+            span_unquote(s, lex_raw(lex, ','), &title);
+            float size[2];
+            if (lex_peek(lex) != ',') {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_window'.");
+                break;
+            }
+            lex->pos++;
+            if (!lex_numbers(lex, size, 2) || !valid_window_size(size[0]) || !valid_window_size(size[1]) ||
+                !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_window'.");
+                break;
             }
+            emit(bc, OP_WINDOW);
+            emit(bc, add_string_constant(bc, s + title.offset, title.length));
+            emit(bc, (uint32_t)(int)size[0]);
+            emit(bc, (uint32_t)(int)size[1]);
+            break;
         }
+
         // Handle 'neko_draw_scene' command (draw scene)
-        else if (strcmp(trimmed_line, "neko_draw_scene") == 0) {
-            if (local_opengl_mode) {
-                neko_draw_scene();
-                glfwSwapBuffers(gl_window);
-                glfwPollEvents();
-
-                // Handle window close event
-                if (glfwWindowShouldClose(gl_window)) {
-                    break;
-                }
-            } else {
-                fprintf(stderr, "Error: OpenGL not initialized. Use 'neko_window' first.\n");
+        case CMD_DRAW_SCENE:
+            if (!lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_draw_scene'.");
+                break;
             }
-        }
+            emit(bc, OP_DRAW_SCENE);
+            break;
+
         // Handle 'neko_add_block' command (add block)
-        else if (strncmp(trimmed_line, "neko_add_block", 14) == 0) {
-            float x, y, z;
-            // Parse parameters: x, y, z
-            if (sscanf(trimmed_line, "neko_add_block %f, %f, %f", &x, &y, &z) == 3) {
-                neko_add_block(x, y, z);
+        case CMD_ADD_BLOCK: {
+            // Parse parameters: x, y, z and an optional block type
+            float type = BLOCK_DEFAULT;
+            if (!lex_numbers(lex, xyz, 3) || !lex_optional_number(lex, &type) ||
+                !valid_block_type(type) || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_add_block'.");
+                break;
+            }
+            emit(bc, OP_ADD_BLOCK);
+            emit_float(bc, xyz[0]);
+            emit_float(bc, xyz[1]);
+            emit_float(bc, xyz[2]);
+            emit(bc, (uint32_t)type);
+            break;
+        }
+
+        // Handle region commands: two corners, then the block type(s) the command needs
+        case CMD_FILL:
+        case CMD_HOLLOW_BOX:
+        case CMD_REPLACE:
+        case CMD_CLEAR: {
+            RegionOp op = command == CMD_FILL ? REGION_FILL : command == CMD_HOLLOW_BOX ? REGION_HOLLOW :
+                          command == CMD_REPLACE ? REGION_REPLACE : REGION_CLEAR;
+            // values: x1, y1, z1, x2, y2, z2, then from and to types (0 stands for air in neko_replace)
+            float values[8] = { 0, 0, 0, 0, 0, 0, BLOCK_AIR, BLOCK_DEFAULT };
+            float *corners = values, *types = values + 6;
+            int ok;
+            if (op == REGION_REPLACE) {
+                ok = lex_numbers(lex, values, 8) &&
+                     (types[0] == BLOCK_AIR || valid_block_type(types[0])) &&
+                     (types[1] == BLOCK_AIR || valid_block_type(types[1]));
+            } else if (op == REGION_CLEAR) {
+                ok = lex_numbers(lex, values, 6);
             } else {
-                fprintf(stderr, "Invalid arguments for 'neko_add_block'.\n");
+                ok = lex_numbers(lex, values, 6) && lex_optional_number(lex, &types[1]) && valid_block_type(types[1]);
             }
+            if (!ok || !lex_end_statement(lex)) {
+                snprintf(message, sizeof(message), "Invalid arguments for '%s'.", region_names[op]);
+                compile_invalid(lex, bc, message);
+                break;
+            }
+            emit(bc, OP_REGION);
+            emit(bc, (uint32_t)op);
+            for (int i = 0; i < 6; i++) emit_float(bc, corners[i]);
+            emit(bc, (uint32_t)types[0]);
+            emit(bc, (uint32_t)types[1]);
+            break;
         }
+
         // Handle 'neko_remove_block' command (remove block)
-        else if (strncmp(trimmed_line, "neko_remove_block", 17) == 0) {
-            float x, y, z;
+        case CMD_REMOVE_BLOCK:
             // Parse parameters: x, y, z
-            if (sscanf(trimmed_line, "neko_remove_block %f, %f, %f", &x, &y, &z) == 3) {
-                neko_remove_block(x, y, z);
-            } else {
-                fprintf(stderr, "Invalid arguments for 'neko_remove_block'.\n");
+            if (!lex_numbers(lex, xyz, 3) || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_remove_block'.");
+                break;
             }
-        }
+            emit(bc, OP_REMOVE_BLOCK);
+            emit_float(bc, xyz[0]);
+            emit_float(bc, xyz[1]);
+            emit_float(bc, xyz[2]);
+            break;
+
         // Handle 'neko_func' command (function definition)
-        else if (strncmp(trimmed_line, "neko_func", 9) == 0) {
-            char *rest = trim(trimmed_line + 9);
-            char *equals = strchr(rest, '=');
-            if (equals) {
-                *equals = '\0';
-                char *func_name = trim(rest);
-                char *func_code = trim(equals + 1);
-                store_function(func_name, func_code);
-                if (verbose) printf("Function '%s' stored.\n", func_name);
+        case CMD_FUNC: {
+            Span name = lex_raw(lex, '=');
+            if (lex_peek(lex) != '=' || name.length == 0) {
+                compile_invalid(lex, bc, "Syntax error in function definition.");
+                break;
+            }
+            lex->pos++;
+
+            // The body runs to the end of the line, or to the next ';' when defined inside another body
+            Span body;
+            if (lex->in_function) {
+                body = lex_raw(lex, '\0');
+                lex_end_statement(lex);
             } else {
-                fprintf(stderr, "Syntax error in function definition.\n");
+                lex_skip_blanks(lex);
+                body.offset = lex->pos;
+                lex_skip_line(lex);
+                body.length = lex->pos - body.offset;
             }
+            emit(bc, OP_DEFINE_FUNC);
+            emit(bc, resolve_function(s + name.offset, name.length));
+            emit(bc, compile_function_body(s, body));
+            break;
         }
+
         // Handle 'call_func' command (function call)
-        else if (strncmp(trimmed_line, "call_func", 9) == 0) {
-            char *func_name = trim(trimmed_line + 9);
-            char *func_code = get_function_code(func_name);
-            if (func_code) {
-                if (verbose) printf("Calling function '%s'.\n", func_name);
-                interpret(func_code, local_opengl_mode); // Recursive call
-            } else {
-                fprintf(stderr, "Error: Function '%s' not defined.\n", func_name);
-            }
+        case CMD_CALL_FUNC: {
+            Span name = lex_raw(lex, '\0');
+            emit(bc, OP_CALL_FUNC);
+            emit(bc, resolve_function(s + name.offset, name.length));
+            lex_end_statement(lex);
+            break;
         }
+
         // Handle 'is_key_pressed' command
-        else if (strncmp(trimmed_line, "is_key_pressed", 14) == 0) {
-            char key[NAME_SIZE];
-            if (sscanf(trimmed_line, "is_key_pressed \"%[^\"]\"", key) == 1) {
-                int pressed = is_key_pressed(key);
-                printf("%d\n", pressed);
-            } else {
-                fprintf(stderr, "Invalid arguments for 'is_key_pressed'.\n");
+        case CMD_IS_KEY_PRESSED: {
+            Token key = lex_next(lex);
+            if (key.kind != TOKEN_STRING) lex->pos = key.span.offset;
+            if (key.kind != TOKEN_STRING || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'is_key_pressed'.");
+                break;
+            }
+            emit(bc, OP_IS_KEY_PRESSED);
+            emit(bc, add_string_constant(bc, s + key.span.offset, key.span.length));
+            break;
+        }
+
+        // Handle 'neko_save_world' and 'neko_load_world' commands (quoted file name)
+        case CMD_SAVE_WORLD:
+        case CMD_LOAD_WORLD: {
+            Token path = lex_next(lex);
+            if (path.kind != TOKEN_STRING || path.span.length == 0) lex->pos = path.span.offset;
+            if (path.kind != TOKEN_STRING || path.span.length == 0 || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, command == CMD_SAVE_WORLD ? "Invalid arguments for 'neko_save_world'."
+                                                                   : "Invalid arguments for 'neko_load_world'.");
+                break;
+            }
+            emit(bc, command == CMD_SAVE_WORLD ? OP_SAVE_WORLD : OP_LOAD_WORLD);
+            emit(bc, add_string_constant(bc, s + path.span.offset, path.span.length));
+            break;
+        }
+
+        // Handle 'neko_stream_world' command: radius in chunks (0 = off), then an optional memory cap in MiB
+        case CMD_STREAM_WORLD: {
+            float values[2] = { 0, 0 };
+            if (!lex_numbers(lex, values, 1) || !lex_optional_number(lex, &values[1]) ||
+                !(values[0] >= 0 && values[0] <= 4096) || !(values[1] >= 0 && values[1] <= 1048576) ||
+                !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_stream_world'.");
+                break;
             }
+            emit(bc, OP_STREAM_WORLD);
+            emit(bc, (uint32_t)values[0]);
+            emit(bc, (uint32_t)values[1]);
+            break;
         }
+
+        // Handle 'neko_stream_stats' command (streaming counters and load latency)
+        case CMD_STREAM_STATS:
+            if (!lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_stream_stats'.");
+                break;
+            }
+            emit(bc, OP_STREAM_STATS);
+            break;
+
         // Handle 'neko_set_player_position' command
-        else if (strncmp(trimmed_line, "neko_set_player_position", 23) == 0) {
-            float x, y, z;
-            if (sscanf(trimmed_line, "neko_set_player_position %f, %f, %f", &x, &y, &z) == 3) {
-                neko_set_player_position(x, y, z);
-            } else {
-                fprintf(stderr, "Invalid arguments for 'neko_set_player_position'.\n");
+        case CMD_SET_PLAYER_POSITION:
+            if (!lex_numbers(lex, xyz, 3) || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_set_player_position'.");
+                break;
+            }
+            emit(bc, OP_SET_PLAYER_POSITION);
+            emit_float(bc, xyz[0]);
+            emit_float(bc, xyz[1]);
+            emit_float(bc, xyz[2]);
+            break;
+
+        // Handle 'neko_render_mode' command (chunked, instanced or per_voxel)
+        case CMD_RENDER_MODE: {
+            Token name = lex_next(lex);
+            int mode = (name.kind == TOKEN_IDENTIFIER || name.kind == TOKEN_STRING)
+                ? parse_render_mode(s + name.span.offset, name.span.length) : -1;
+            if (mode < 0) lex->pos = name.span.offset;
+            if (mode < 0 || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_render_mode'.");
+                break;
             }
+            emit(bc, OP_RENDER_MODE);
+            emit(bc, (uint32_t)mode);
+            break;
         }
+
+        // Handle 'neko_world_storage' command (flat, octree or palette)
+        case CMD_WORLD_STORAGE: {
+            Token name = lex_next(lex);
+            int storage = (name.kind == TOKEN_IDENTIFIER || name.kind == TOKEN_STRING)
+                ? parse_world_storage(s + name.span.offset, name.span.length) : -1;
+            if (storage < 0) lex->pos = name.span.offset;
+            if (storage < 0 || !lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_world_storage'.");
+                break;
+            }
+            emit(bc, OP_WORLD_STORAGE);
+            emit(bc, (uint32_t)storage);
+            break;
+        }
+
+        // Handle 'neko_render_stats' command (culling counts of the last frame)
+        case CMD_RENDER_STATS:
+            if (!lex_end_statement(lex)) {
+                compile_invalid(lex, bc, "Invalid arguments for 'neko_render_stats'.");
+                break;
+            }
+            emit(bc, OP_RENDER_STATS);
+            break;
+
         // Handle unknown commands
-        else {
-            fprintf(stderr, "Unknown command: %s\n", trimmed_line);
+        case CMD_UNKNOWN: {
+            Span rest = lex_raw(lex, '\0');
+            size_t length = rest.offset + rest.length - word.span.offset;
+            snprintf(message, sizeof(message), "Unknown command: %.*s", (int)length, s + word.span.offset);
+            emit_error(bc, message);
+            lex_end_statement(lex);
+            break;
         }
     }
+}
 
-    // If GUI mode is enabled, run the main OpenGL loop
-    if (local_opengl_mode) {
+// Function to compile a function body (statements separated by ';') into its own bytecode
+uint32_t compile_function_body(const char *source, Span body) {
+    Bytecode *func_bc = (Bytecode *)calloc(1, sizeof(Bytecode));
+    if (func_bc == NULL) {
+        fprintf(stderr, "Memory allocation failed for function code.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Lex only the body's span of the source
+    Lexer lex = {source, body.offset + body.length, body.offset, 1};
+    while (!lex_at_end(&lex)) {
+        Token token = lex_next(&lex);
+        if (token.kind == TOKEN_END) break;
+        if (token.kind == TOKEN_NEWLINE) continue;
+        if (token.kind == TOKEN_SYMBOL && source[token.span.offset] == ';') continue;
+        if (token.kind != TOKEN_IDENTIFIER) {
+            lex.pos = token.span.offset;
+            token.span.length = 0; // Reported as an unknown command
+        }
+        compile_statement(&lex, func_bc, token);
+    }
+    emit(func_bc, OP_HALT);
+    return add_function_body(func_bc);
+}
+
+// Function to compile statements until the lexer passes stop_at; returns 1 if source remains
+int compile_batch(Compiler *compiler, Bytecode *bc, size_t stop_at) {
+    Lexer *lex = &compiler->lex;
+    const char *code = lex->source;
+
+    while (!lex_at_end(lex) && lex->pos < stop_at) {
+        Token token = lex_next(lex);
+        if (token.kind == TOKEN_END) break;
+
+        // Skip empty statements
+        if (token.kind == TOKEN_NEWLINE) continue;
+        if (token.kind == TOKEN_SYMBOL && code[token.span.offset] == ';') continue;
+
+        // Skip comments
+        if (token.kind == TOKEN_SYMBOL && code[token.span.offset] == '/' && lex_peek(lex) == '/') {
+            lex_skip_line(lex);
+            continue;
+        }
+
+        // Check for 'neko {' to enter the block
+        if (token.kind == TOKEN_IDENTIFIER && token.span.length == 4 && memcmp(code + token.span.offset, "neko", 4) == 0) {
+            size_t after_word = lex->pos;
+            Token brace = lex_next(lex);
+            if (brace.kind == TOKEN_SYMBOL && code[brace.span.offset] == '{') {
+                compiler->in_neko_block = 1;
+                emit_trace(bc, "Entering 'neko' block.");
+                continue;
+            }
+            lex->pos = after_word;
+        }
+
+        // Check for '}' to exit the block
+        if (token.kind == TOKEN_SYMBOL && code[token.span.offset] == '}') {
+            compiler->in_neko_block = 0;
+            emit_trace(bc, "Exiting 'neko' block.");
+            continue;
+        }
+
+        if (!compiler->in_neko_block) {
+            lex_skip_line(lex);
+            continue;
+        }
+
+        if (token.kind != TOKEN_IDENTIFIER) {
+            lex->pos = token.span.offset;
+            token.span.length = 0; // Reported as an unknown command
+        }
+        compile_statement(lex, bc, token);
+    }
+    emit(bc, OP_HALT);
+    return !lex_at_end(lex);
+}
+
+// Function to compile NekoLang source code into bytecode, lexing it in place
+void compile(const char *code, size_t length, Bytecode *bc) {
+    Compiler compiler = {{code, length, 0, 0}, 0};
+    compile_batch(&compiler, bc, length);
+}
+
+// Function to read a float operand from the bytecode
+float read_float(const uint32_t *ip) {
+    float value;
+    memcpy(&value, ip, sizeof(value));
+    return value;
+}
+
+// Function to execute compiled bytecode; returns 1 if the script asked to stop
+int run_bytecode(const Bytecode *bc, int *gui_mode) {
+    const uint32_t *ip = bc->code;
+    NekoString *strings = bc->strings;
+
+    for (;;) {
+        switch ((OpCode)*ip++) {
+            case OP_HALT:
+                return 0;
+
+            case OP_PURR: {
+                uint32_t piece_count = *ip++;
+                StringBuilder *output = &purr_builder;
+                output->length = 0;
+                for (uint32_t i = 0; i < piece_count; i++, ip += 2) {
+                    NekoString *piece;
+                    if (ip[0] == PIECE_VARIABLE) {
+                        Variable *var = &variable_slots[ip[1]];
+                        if (!var->defined) {
+                            builder_append(output, "(undefined)", 11);
+                            continue;
+                        }
+                        piece = &var->value;
+                    } else {
+                        piece = &strings[ip[1]];
+                    }
+                    builder_append(output, string_data(piece), piece->length);
+                }
+                builder_append(output, "\n", 1);
+                output_write(output->data, output->length);
+                break;
+            }
+
+            case OP_KITTEN: {
+                NekoString *value = &strings[ip[1]];
+                assign_variable(ip[0], string_data(value), value->length);
+                if (verbose) output_printf("Variable '%s' set to '%s'.\n", variable_slots[ip[0]].symbol->name, string_data(value));
+                ip += 2;
+                break;
+            }
+
+            case OP_MEOW: {
+                uint32_t slot = *ip++;
+                const char *var_name = variable_slots[slot].symbol->name;
+                char prompt[INPUT_SIZE];
+                snprintf(prompt, sizeof(prompt), "Enter value for %s: ", var_name);
+                char *input = get_user_input(prompt);
+                if (input == NULL || input[0] == '\0') {
+                    fprintf(stderr, "Error: Input for %s is empty.\n", var_name);
+                    break;
+                }
+                assign_variable(slot, input, strlen(input));
+                if (verbose) output_printf("Variable '%s' updated with value '%s'.\n", var_name, input);
+                break;
+            }
+
+            case OP_WINDOW: {
+                const char *title = string_data(&strings[ip[0]]);
+                int width = (int)ip[1];
+                int height = (int)ip[2];
+                ip += 3;
+                *gui_mode = 1; // Enable OpenGL mode
+                if (headless_mode) {
+                    neko_headless_window(width, height);
+                    if (verbose) output_printf("Headless framebuffer for '%s' created with size %dx%d.\n", title, width, height);
+                } else {
+                    neko_window(title, width, height);
+                    if (verbose) output_printf("OpenGL window '%s' created with size %dx%d.\n", title, width, height);
+                }
+                break;
+            }
+
+            case OP_DRAW_SCENE:
+                if (*gui_mode) {
+                    render_frame();
+
+                    // Handle window close event
+                    if (!headless_mode && glfwWindowShouldClose(gl_window)) {
+                        return 1;
+                    }
+                } else {
+                    fprintf(stderr, "Error: OpenGL not initialized. Use 'neko_window' first.\n");
+                }
+                break;
+
+            case OP_ADD_BLOCK:
+                neko_add_block(read_float(ip), read_float(ip + 1), read_float(ip + 2), (uint16_t)ip[3]);
+                ip += 4;
+                break;
+
+            case OP_REGION: {
+                float corners[6];
+                for (int i = 0; i < 6; i++) corners[i] = read_float(ip + 1 + i);
+                neko_region((RegionOp)ip[0], corners, (uint16_t)ip[7], (uint16_t)ip[8]);
+                ip += 9;
+                break;
+            }
+
+            case OP_REMOVE_BLOCK:
+                neko_remove_block(read_float(ip), read_float(ip + 1), read_float(ip + 2));
+                ip += 3;
+                break;
+
+            case OP_SAVE_WORLD:
+                neko_save_world(string_data(&strings[*ip++]));
+                break;
+
+            case OP_LOAD_WORLD:
+                neko_load_world(string_data(&strings[*ip++]));
+                break;
+
+            case OP_STREAM_WORLD:
+                neko_stream_world((int)ip[0], (size_t)ip[1] * 1024 * 1024);
+                ip += 2;
+                break;
+
+            case OP_STREAM_STATS:
+                neko_stream_stats();
+                break;
+
+            case OP_WORLD_STORAGE:
+                neko_world_storage((WorldStorage)*ip++);
+                break;
+
+            case OP_DEFINE_FUNC: {
+                Function *func = &functions[ip[0]];
+                func->body = function_bodies[ip[1]];
+                ip += 2;
+                if (verbose) output_printf("Function '%s' stored.\n", func->symbol->name);
+                break;
+            }
+
+            case OP_CALL_FUNC: {
+                Function *func = &functions[*ip++];
+                if (func->body == NULL) {
+                    fprintf(stderr, "Error: Function '%s' not defined.\n", func->symbol->name);
+                    break;
+                }
+                if (call_depth >= MAX_CALL_DEPTH) {
+                    fprintf(stderr, "Error: Maximum call depth exceeded in '%s'.\n", func->symbol->name);
+                    break;
+                }
+                if (verbose) output_printf("Calling function '%s'.\n", func->symbol->name);
+                call_depth++;
+                int stop = run_bytecode(func->body, gui_mode);
+                call_depth--;
+                if (stop) return 1;
+                break;
+            }
+
+            case OP_IS_KEY_PRESSED:
+                output_printf("%d\n", is_key_pressed(string_data(&strings[*ip++])));
+                break;
+
+            case OP_SET_PLAYER_POSITION:
+                neko_set_player_position(read_float(ip), read_float(ip + 1), read_float(ip + 2));
+                ip += 3;
+                break;
+
+            case OP_RENDER_MODE:
+                render_mode = (RenderMode)*ip++;
+                if (verbose) output_printf("Render mode set to %s.\n", render_mode_names[render_mode]);
+                break;
+
+            case OP_RENDER_STATS:
+                output_printf("Chunks drawn: %zu, culled: %zu (of %zu), remeshed: %zu, waiting: %zu.\n",
+                              chunks_drawn, chunks_culled, chunk_count, chunks_remeshed, remesh_count + jobs_in_flight);
+                break;
+
+            case OP_ERROR:
+                fprintf(stderr, "%s\n", string_data(&strings[*ip++]));
+                break;
+
+            case OP_TRACE:
+                output_printf("%s\n", string_data(&strings[*ip++]));
+                break;
+
+            default:
+                fprintf(stderr, "Error: Corrupted bytecode.\n");
+                return 1;
+        }
+    }
+}
+
+// Function to interpret and execute NekoLang code
+void interpret(const char *code, size_t length) {
+    int local_opengl_mode = 0; // Switched on when the script opens a window
+
+    // Parse the source once, then run the compiled form. In streaming mode the
+    // script is compiled and run one batch at a time, so execution starts before
+    // the whole file has been read.
+    Compiler compiler = {{code, length, 0, 0}, 0};
+    Bytecode bc = {0};
+    int more = 1;
+    while (more) {
+        size_t stop_at = stream_mode ? compiler.lex.pos + STREAM_BATCH_BYTES : length;
+        more = compile_batch(&compiler, &bc, stop_at);
+        if (run_bytecode(&bc, &local_opengl_mode)) break;
+        reset_bytecode(&bc);
+    }
+    free_bytecode(&bc);
+    output_flush(); // Everything the script printed is visible before the window loop
+
+    // Headless runs render a fixed number of frames instead of the window loop
+    if (local_opengl_mode && headless_mode) {
+        run_headless_frames();
+    } else if (local_opengl_mode) {
         // Main loop
         while (!glfwWindowShouldClose(gl_window)) {
-            neko_draw_scene();
-            glfwSwapBuffers(gl_window);
-            glfwPollEvents();
+            render_frame();
 
             // Basic player movement controls
             if (glfwGetKey(gl_window, GLFW_KEY_W) == GLFW_PRESS) {
                 player_z -= 0.05f;
+                camera_dirty = 1;
             }
             if (glfwGetKey(gl_window, GLFW_KEY_S) == GLFW_PRESS) {
                 player_z += 0.05f;
+                camera_dirty = 1;
             }
             if (glfwGetKey(gl_window, GLFW_KEY_A) == GLFW_PRESS) {
                 player_x -= 0.05f;
+                camera_dirty = 1;
             }
             if (glfwGetKey(gl_window, GLFW_KEY_D) == GLFW_PRESS) {
                 player_x += 0.05f;
+                camera_dirty = 1;
             }
 
             // Close window on ESC key
@@ -739,93 +4903,145 @@ void interpret(const char *code, int gui_mode) {
                 glfwSetWindowShouldClose(gl_window, GLFW_TRUE);
             }
         }
+    }
 
-        // Clean up resources after the loop
+    // Clean up resources after the loop
+    if (local_opengl_mode) {
+        if (stats_path) write_stats_file(stats_path);
         cleanup();
     }
 }
 
-// Function to read code from a file
-char* read_code_from_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+// Function to load a script, mapping regular files instead of copying them; returns 0 on success
+int load_script_file(const char *filename, ScriptSource *script) {
+    memset(script, 0, sizeof(*script));
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         fprintf(stderr, "Error: Unable to open file %s\n", filename);
-        return NULL;
+        return -1;
     }
 
-    // Determine file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-
-    // Allocate memory for code
-    char *code = (char *)malloc(file_size + 1);
-    if (code == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
-        fclose(file);
-        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // Scripts are read front to back exactly once
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            script->code = (const char *)map;
+            script->length = (size_t)st.st_size;
+            script->mapped = 1;
+            return 0;
+        }
     }
 
-    // Read file content
-    size_t read_size = fread(code, 1, file_size, file);
-    code[read_size] = '\0'; // Null-terminate
-    fclose(file);
-
-    return code;
+    // Pipes and other unmappable files are read into memory
+    size_t capacity = 64 * 1024, length = 0;
+    char *code = (char *)malloc(capacity);
+    for (;;) {
+        if (code == NULL) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            close(fd);
+            return -1;
+        }
+        if (length == capacity) {
+            capacity *= 2;
+            char *new_code = (char *)realloc(code, capacity);
+            if (new_code == NULL) free(code);
+            code = new_code;
+            continue;
+        }
+        ssize_t n = read(fd, code + length, capacity - length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        length += (size_t)n;
+    }
+    close(fd);
+    script->code = code;
+    script->length = length;
+    script->mapped = 0;
+    return 0;
 }
 
-// Function to detect if the script uses GUI mode
-int detect_gui_mode(const char *code) {
-    // Look for the presence of 'neko_window' command
-    if (strstr(code, "neko_window") != NULL) {
-        return 1; // GUI mode detected
+// Function to release a loaded script
+void free_script_file(ScriptSource *script) {
+    if (script->mapped) {
+        munmap((void *)script->code, script->length);
+    } else {
+        free((void *)script->code);
     }
-    return 0; // Console mode
+    memset(script, 0, sizeof(*script));
 }
 
 // Function to clean up resources
 void cleanup() {
+    // Stop the meshing workers before the chunks their results refer to go away
+    stop_mesh_workers();
+
+    // Free chunks, deleting their meshes while the GL context still exists
+    clear_world();
+    free(mesh_scratch.data);
+    memset(&mesh_scratch, 0, sizeof(mesh_scratch));
+
     // Delete OpenGL resources if initialized
     if (opengl_initialized) {
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
+        glDeleteVertexArrays(1, &instance_VAO);
+        glDeleteBuffers(1, &instance_VBO);
+        glDeleteBuffers(1, &camera_UBO);
+        if (gpu_queries[0]) glDeleteQueries(2, gpu_queries);
+        gpu_queries[0] = gpu_queries[1] = 0;
+        gpu_query_pending[0] = gpu_query_pending[1] = 0;
+        gpu_query_frame = 0;
         glDeleteProgram(shaderProgram);
     }
 
+    // Release the offscreen context once everything that needed it is gone
+    if (headless_mode) headless_shutdown();
+
     // Destroy GLFW window if created
     if (gl_window) {
         glfwDestroyWindow(gl_window);
+        gl_window = NULL;
     }
 
     // Terminate GLFW if initialized
     if (opengl_initialized) {
-        glfwTerminate();
+        if (!headless_mode) glfwTerminate();
+        opengl_initialized = 0;
     }
 
-    // Free voxels
-    Voxel *current = voxels_head;
-    while (current != NULL) {
-        Voxel *temp = current;
-        current = current->next;
-        free(temp);
-    }
+    builder_free(&purr_builder);
 
-    // Free variables
-    Variable *var = variables_head;
-    while (var != NULL) {
-        Variable *temp = var;
-        var = var->next;
-        free(temp);
+    // Free variables and interned names
+    for (size_t i = 0; i < variable_count; i++) {
+        string_free(&variable_slots[i].value);
     }
+    free(variable_slots);
+    variable_slots = NULL;
+    variable_count = variable_slot_capacity = 0;
+    free(variable_index);
+    variable_index = NULL;
+    variable_index_capacity = 0;
+    for (size_t i = 0; i < symbol_capacity; i++) {
+        free(symbols[i]);
+    }
+    free(symbols);
+    symbols = NULL;
+    symbol_count = symbol_capacity = 0;
 
-    // Free functions
-    Function *func = functions_head;
-    while (func != NULL) {
-        Function *temp = func;
-        func = func->next;
-        free(temp->code);
-        free(temp);
+    // Free functions and their compiled bodies
+    for (size_t i = 0; i < function_body_count; i++) {
+        free_bytecode(function_bodies[i]);
+        free(function_bodies[i]);
     }
+    free(function_bodies);
+    function_bodies = NULL;
+    function_body_count = function_body_capacity = 0;
+    free(functions);
+    functions = NULL;
+    function_count = function_capacity = 0;
 }
 
 // Alternate main for standalone interpreter
@@ -833,14 +5049,11 @@ void cleanup() {
 int main(int argc, char *argv[]) {
     // Read code from standard input
     char code_buffer[FUNCTION_CODE_SIZE];
-    size_t len = fread(code_buffer, 1, sizeof(code_buffer) - 1, stdin);
-    code_buffer[len] = '\0'; // Null-terminate
-
-    // Detect execution mode
-    int gui_mode = detect_gui_mode(code_buffer);
+    size_t len = fread(code_buffer, 1, sizeof(code_buffer), stdin);
 
     // Interpret the code
-    interpret(code_buffer, gui_mode);
+    interpret(code_buffer, len);
+    cleanup();
 
     return 0;
 }
@@ -853,40 +5066,142 @@ int main(int argc, char *argv[]) {
         printf("Usage: %s <filename> [options]\n", argv[0]);
         printf("Options:\n");
         printf("  -v      Enable verbose mode for debugging\n");
+        printf("  --flush=line|size|end\n");
+        printf("          When to write buffered output (default: line on a terminal, size otherwise)\n");
+        printf("  --stream  Compile and run the script in batches as it is read\n");
+        printf("  --render=chunked|instanced|per_voxel\n");
+        printf("          How blocks are drawn (default: chunked)\n");
+        printf("  --remesh-budget=N\n");
+        printf("          Chunk meshes rebuilt per frame at most, 0 for no limit (default: 16)\n");
+        printf("  --mesh-threads=N\n");
+        printf("          Worker threads that build chunk meshes, 0 to mesh on the main thread\n");
+        printf("          (default: one per core, leaving one for rendering)\n");
+        printf("  --headless  Render offscreen through EGL instead of opening a window\n");
+        printf("  --frames=N  Frames to render in headless mode (default: 100)\n");
+        printf("  --dump-frame=FILE.ppm\n");
+        printf("          Write the last headless frame to a PPM image\n");
+        printf("  --stats=FILE.csv|FILE.json\n");
+        printf("          Write frame time percentiles per phase when rendering ends\n");
+        printf("  --overlay  Show frame times in the window title\n");
+        printf("  --storage=flat|octree|palette\n");
+        printf("          How resident chunks store their blocks (default: flat)\n");
+        printf("  --palette-cache=N\n");
+        printf("          Palette chunks kept unpacked after a write (default: 64)\n");
+        printf("  --stream-radius=N\n");
+        printf("          Keep only chunks within N chunks of the player resident (default: 0, all)\n");
+        printf("  --memory-cap=MIB\n");
+        printf("          Resident block and mesh memory at most while streaming (default: 0, no cap)\n");
         return EXIT_FAILURE;
     }
 
-    // Parse command-line arguments for verbose mode
+    // Buffered output is line-flushed on a terminal and written in large chunks otherwise
+    flush_policy = isatty(STDOUT_FILENO) ? FLUSH_LINE : FLUSH_SIZE;
+    atexit(output_flush);
+
+    // Parse command-line arguments
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-v") == 0) {
             verbose = 1;
+        } else if (strcmp(argv[i], "--flush=line") == 0) {
+            flush_policy = FLUSH_LINE;
+        } else if (strcmp(argv[i], "--flush=size") == 0) {
+            flush_policy = FLUSH_SIZE;
+        } else if (strcmp(argv[i], "--flush=end") == 0) {
+            flush_policy = FLUSH_END;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream_mode = 1;
+        } else if (strncmp(argv[i], "--render=", 9) == 0) {
+            int mode = parse_render_mode(argv[i] + 9, strlen(argv[i] + 9));
+            if (mode < 0) {
+                fprintf(stderr, "Unknown render mode: %s\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+            render_mode = (RenderMode)mode;
+        } else if (strncmp(argv[i], "--remesh-budget=", 16) == 0) {
+            char *end;
+            long budget = strtol(argv[i] + 16, &end, 10);
+            if (end == argv[i] + 16 || *end != '\0' || budget < 0) {
+                fprintf(stderr, "Invalid remesh budget: %s\n", argv[i] + 16);
+                return EXIT_FAILURE;
+            }
+            remesh_budget = (size_t)budget;
+        } else if (strncmp(argv[i], "--mesh-threads=", 15) == 0) {
+            char *end;
+            long threads = strtol(argv[i] + 15, &end, 10);
+            if (end == argv[i] + 15 || *end != '\0' || threads < 0 || threads > 256) {
+                fprintf(stderr, "Invalid mesh thread count: %s\n", argv[i] + 15);
+                return EXIT_FAILURE;
+            }
+            mesh_thread_count = (int)threads;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless_mode = 1;
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            char *end;
+            long frames = strtol(argv[i] + 9, &end, 10);
+            if (end == argv[i] + 9 || *end != '\0' || frames < 0 || frames > 1000000) {
+                fprintf(stderr, "Invalid frame count: %s\n", argv[i] + 9);
+                return EXIT_FAILURE;
+            }
+            headless_frames = (int)frames;
+        } else if (strncmp(argv[i], "--dump-frame=", 13) == 0) {
+            dump_frame_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            stats_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--overlay") == 0) {
+            stats_overlay = 1;
+        } else if (strncmp(argv[i], "--storage=", 10) == 0) {
+            int storage = parse_world_storage(argv[i] + 10, strlen(argv[i] + 10));
+            if (storage < 0) {
+                fprintf(stderr, "Unknown world storage: %s\n", argv[i] + 10);
+                return EXIT_FAILURE;
+            }
+            world_storage = (WorldStorage)storage;
+        } else if (strncmp(argv[i], "--palette-cache=", 16) == 0) {
+            char *end;
+            long size = strtol(argv[i] + 16, &end, 10);
+            if (end == argv[i] + 16 || *end != '\0' || size < 1 || size > 1048576) {
+                fprintf(stderr, "Invalid palette cache size: %s\n", argv[i] + 16);
+                return EXIT_FAILURE;
+            }
+            palette_cache_size = (size_t)size;
+        } else if (strncmp(argv[i], "--stream-radius=", 16) == 0) {
+            char *end;
+            long radius = strtol(argv[i] + 16, &end, 10);
+            if (end == argv[i] + 16 || *end != '\0' || radius < 0 || radius > 4096) {
+                fprintf(stderr, "Invalid stream radius: %s\n", argv[i] + 16);
+                return EXIT_FAILURE;
+            }
+            world_stream_radius = (int)radius;
+        } else if (strncmp(argv[i], "--memory-cap=", 13) == 0) {
+            char *end;
+            long cap = strtol(argv[i] + 13, &end, 10);
+            if (end == argv[i] + 13 || *end != '\0' || cap < 0 || cap > 1048576) {
+                fprintf(stderr, "Invalid memory cap: %s\n", argv[i] + 13);
+                return EXIT_FAILURE;
+            }
+            world_memory_cap = (size_t)cap * 1024 * 1024;
         }
     }
 
-    // Read the NekoLang script from the file
-    char *code = read_code_from_file(argv[1]);
-    if (code == NULL) {
+    // Map the NekoLang script from the file
+    ScriptSource script;
+    if (load_script_file(argv[1], &script) != 0) {
         return EXIT_FAILURE;
     }
 
-    // Detect execution mode (Console or GUI)
-    int gui_mode = detect_gui_mode(code);
-
     if (verbose) {
-        printf("Mode %s activated.\n", gui_mode ? "GUI" : "Console");
-        printf("Executing script: %s\n", argv[1]);
+        output_printf("Executing script: %s (%zu bytes, %s%s)\n", argv[1], script.length,
+                      script.mapped ? "mapped" : "read", stream_mode ? ", streaming" : "");
     }
 
-    // Interpret the script with the detected mode
-    interpret(code, gui_mode);
+    // Interpret the script; GUI mode starts when it opens a window
+    interpret(script.code, script.length);
 
-    // Free the allocated memory for code
-    free(code);
+    // Release the script and everything it created
+    free_script_file(&script);
+    cleanup();
 
-    // Clean up resources if not in GUI mode
-    if (!gui_mode) {
-        cleanup();
-    }
+    output_flush();
 
     return EXIT_SUCCESS;
 }